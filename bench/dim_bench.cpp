@@ -0,0 +1,61 @@
+﻿// 截图遮罩内核的性能测试：在固定的 7680x2160 图片上分别运行每个可用的指令集，输出每百万像素的耗时
+// 构建：cmake -DBUILD_BENCH=ON，运行 dim_bench [次数]
+#include "ImageKernel.h"
+
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+
+static constexpr int benchWidth = 7680;
+static constexpr int benchHeight = 2160;
+
+int main(int argc, char *argv[]) {
+    const int rounds = argc > 1 ? qMax(1, atoi(argv[1])) : 20;
+    // 固定种子的伪随机内容，每次运行输入相同
+    QImage src(benchWidth, benchHeight, QImage::Format_RGB32);
+    quint32 state = 0x12345678;
+    for (int y = 0; y < src.height(); ++y) {
+        quint32 *line = reinterpret_cast<quint32*>(src.scanLine(y));
+        for (int x = 0; x < src.width(); ++x) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            line[x] = state;
+        }
+    }
+    const double megapixels = static_cast<double>(benchWidth) * benchHeight / 1e6;
+    printf("dimImage %dx%d (%.1f MP), %d rounds, %d pool threads, default %s\n",
+           benchWidth, benchHeight, megapixels, rounds, QThreadPool::globalInstance()->maxThreadCount(), dimKernelName());
+
+    QImage reference;
+    const QVector<const char*> names = dimKernelNames();
+    for (auto iter = names.cbegin(); iter != names.cend(); ++iter) {
+        QImage dst(src.size(), QImage::Format_ARGB32);
+        // 第一次运行让线程池启动线程、分配页面，不计入结果
+        dimImage(src, dst, *iter);
+        qint64 total = 0;
+        qint64 best = std::numeric_limits<qint64>::max();
+        QElapsedTimer timer;
+        for (int i = 0; i < rounds; ++i) {
+            timer.start();
+            dimImage(src, dst, *iter);
+            const qint64 nsecs = timer.nsecsElapsed();
+            total += nsecs;
+            best = std::min(best, nsecs);
+        }
+        const double average = total / 1e6 / rounds;
+        printf("%-8s avg %8.3f ms  %7.3f ms/MP   min %8.3f ms  %7.3f ms/MP\n",
+               *iter, average, average / megapixels, best / 1e6, best / 1e6 / megapixels);
+        // 所有实现的结果必须逐字节相同
+        if (reference.isNull()) {
+            reference = dst;
+        } else if (dst != reference) {
+            printf("%s 的结果与 %s 不同\n", *iter, names.first());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+﻿#include "AutoSaver.h"
+
+#include <QDir>
+#include <QSaveFile>
+#include <QDebug>
+
+AutoSaver::AutoSaver(QObject *parent): QObject{parent}, m_pending{0}, m_limit{4} {
+    // 编码比较耗 CPU，最多占用一半的核心
+    int count = qBound(1, static_cast<int>(std::thread::hardware_concurrency() / 2), 4);
+    for (int i = 0; i < count; ++i) {
+        m_threads.emplace_back(&AutoSaver::run, this);
+    }
+}
+
+AutoSaver::~AutoSaver() {
+    // 已经截好的图片保存完再退出
+    m_queue.close();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void AutoSaver::setLimit(int limit) {
+    m_limit = qMax(1, limit);
+}
+
+int AutoSaver::limit() const {
+    return m_limit;
+}
+
+bool AutoSaver::isFull() const {
+    return m_pending >= m_limit;
+}
+
+bool AutoSaver::save(const QImage &image, const QString &dir, const QString &title, const QString &format, bool quiet) {
+    if (++m_pending > m_limit) {
+        --m_pending;
+        return false;
+    }
+    if (! m_queue.enqueue({image, dir, title, format, QDateTime::currentDateTime(), quiet})) {
+        --m_pending;
+        return false;
+    }
+    return true;
+}
+
+int AutoSaver::saveBatch(const QVector<QImage> &images, const QString &dir, const QString &title, const QString &format) {
+    const QDateTime time = QDateTime::currentDateTime();
+    int count = 0;
+    for (int i = 0; i < images.size(); ++i) {
+        ++m_pending;
+        const QString name = QString("%1_%2").arg(title).arg(i + 1, 2, 10, QChar('0'));
+        if (! m_queue.enqueue({images[i], dir, name, format, time, true})) {
+            --m_pending;
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+void AutoSaver::run() {
+    Task task;
+    while (m_queue.dequeue(&task)) {
+        const QString datetimeString = task.time.toString("yyyy-MM-dd-hh-mm-ss.zzz");
+        QString imagePath = QString("%1%2%3_%4.%5").arg(task.dir, QDir::separator(), task.title, datetimeString, task.format);
+        bool ret = write(task.image, imagePath, task.format);
+        if (! ret) {
+            imagePath = QString("%1%2%3.%4").arg(task.dir, QDir::separator(), datetimeString, task.format);
+            ret = write(task.image, imagePath, task.format);
+        }
+        QImage thumbnail;
+        if (ret && ! task.quiet) {
+            thumbnail = task.image.scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+        task.image = QImage();
+        --m_pending;
+        emit saved(ret, imagePath, thumbnail);
+    }
+}
+
+bool AutoSaver::write(const QImage &image, const QString &path, const QString &format) {
+    // QSaveFile 写入同目录下的临时文件，commit 时重命名，不会留下写了一半的图片
+    QSaveFile file{path};
+    if (! file.open(QIODevice::WriteOnly)) {
+        qWarning() << "打开文件失败" << path << file.errorString();
+        return false;
+    }
+    if (! image.save(&file, format.toUtf8().constData())) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
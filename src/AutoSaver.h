@@ -0,0 +1,54 @@
+﻿#ifndef AUTOSAVER_H
+#define AUTOSAVER_H
+
+#include <QObject>
+#include <QImage>
+#include <QDateTime>
+#include <QVector>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "BlockQueue.h"
+
+// 自动保存的后台线程池，编码和写文件都不在界面线程进行，
+// 先写入临时文件再重命名，保存完成后通过 saved 信号通知
+class AutoSaver : public QObject {
+    Q_OBJECT
+public:
+    explicit AutoSaver(QObject *parent = nullptr);
+    ~AutoSaver();
+
+    // 同时在保存的截图数量上限
+    void setLimit(int limit);
+    int limit() const;
+    bool isFull() const;
+    // 超过上限时返回 false，image 不能与其他截图共用数据
+    // quiet 为 true 时不生成缩略图，saved 信号里的缩略图为空
+    bool save(const QImage &image, const QString &dir, const QString &title, const QString &format, bool quiet = false);
+    // 一批图片整体入队，不受 limit 限制，文件名为 title_01、title_02…，返回入队的数量
+    // 批量中的图片计入正在保存的数量，保存完之前其他截图仍按 limit 判断
+    int saveBatch(const QVector<QImage> &images, const QString &dir, const QString &title, const QString &format);
+
+signals:
+    void saved(bool success, const QString &path, const QImage &thumbnail);
+
+private:
+    struct Task {
+        QImage image;
+        QString dir;
+        QString title;
+        QString format;
+        QDateTime time;
+        bool quiet = false;
+    };
+    void run();
+    static bool write(const QImage &image, const QString &path, const QString &format);
+
+    BlockQueue<Task> m_queue;
+    std::vector<std::thread> m_threads;
+    std::atomic_int m_pending;
+    std::atomic_int m_limit;
+};
+
+#endif // AUTOSAVER_H
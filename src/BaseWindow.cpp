@@ -1,4 +1,5 @@
 ﻿#include "BaseWindow.h"
+#include "CaptureEngine.h"
 
 BaseWindow::BaseWindow(QWidget *parent): QWidget{parent}, m_press{false}, m_shape{nullptr}, m_tool{new Tool{this}}, m_edit{nullptr}, m_ignore{false} {
     setWindowFlags(Qt::FramelessWindowHint | Qt::WindowStaysOnTopHint | Qt::Tool);
@@ -137,30 +138,7 @@ void BaseWindow::setShape(const QPoint &point) {
 }
 
 QPoint BaseWindow::getScreenPoint(const QPoint &point) {
-    if (m_ratio == 1) return point;
-
-    QPoint pos = point * m_ratio;
-    QList<QScreen*> list = QApplication::screens();
-    QScreen* targetScreen = nullptr;
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect tmp = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        tmp.setWidth(tmp.width() * ratio);
-        tmp.setHeight(tmp.height() * ratio);
-        if (tmp.contains(pos)) {
-            targetScreen = *iter;
-            break;
-        }
-    }
-    if (! targetScreen) {
-        targetScreen = QApplication::primaryScreen();
-    }
-
-    QRect targetRect = targetScreen->geometry();
-    int x = (pos.x() - targetRect.left()) / m_ratio + targetRect.left();
-    int y = (pos.y() - targetRect.top()) / m_ratio + targetRect.top();
-
-    return {x, y};
+    return CaptureEngine::instance()->toScreenPoint(point, m_ratio);
 }
 
 QRect BaseWindow::getScreenRect(const QRect &rect) {
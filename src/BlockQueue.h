@@ -12,22 +12,17 @@ public:
     bool enqueue(T&& item) {
         QMutexLocker locker{&m_mutex};
         if (m_closed) return false;
-        bool empty = m_queue.isEmpty();
         m_queue.enqueue(std::move(item));
-        if (empty) {
-            m_cond.wakeOne();
-        }
+        // 每入队一个都唤醒一个消费者，多个线程消费时连续入队的任务才能并行处理
+        m_cond.wakeOne();
         return true;
     }
 
     bool enqueue(const T& item) {
         QMutexLocker locker{&m_mutex};
         if (m_closed) return false;
-        bool empty = m_queue.isEmpty();
         m_queue.enqueue(item);
-        if (empty) {
-            m_cond.wakeOne();
-        }
+        m_cond.wakeOne();
         return true;
     }
 
@@ -0,0 +1,463 @@
+﻿#include "CaptureEngine.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+#include <QPixmap>
+#include <QPainter>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include "XShmCapture.h"
+#include "WindowCapture.h"
+#endif // Q_OS_LINUX
+
+// src 为 32 位 xRGB 像素，按 dst 的格式写入，alpha 固定为 255
+static void copyPixels(const QImage &src, QImage &dst) {
+    const int width = qMin(src.width(), dst.width());
+    const int height = qMin(src.height(), dst.height());
+    for (int y = 0; y < height; ++y) {
+        const quint32 *s = reinterpret_cast<const quint32*>(src.constScanLine(y));
+        uchar *d = dst.scanLine(y);
+        switch (dst.format()) {
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+        case QImage::Format_ARGB32_Premultiplied: {
+            quint32 *p = reinterpret_cast<quint32*>(d);
+            for (int x = 0; x < width; ++x) {
+                p[x] = s[x] | 0xff000000;
+            }
+            break;
+        }
+        case QImage::Format_RGBA8888:
+            for (int x = 0; x < width; ++x, d += 4) {
+                d[0] = static_cast<uchar>(s[x] >> 16);
+                d[1] = static_cast<uchar>(s[x] >> 8);
+                d[2] = static_cast<uchar>(s[x]);
+                d[3] = 0xff;
+            }
+            break;
+        case QImage::Format_BGR888:
+            for (int x = 0; x < width; ++x, d += 3) {
+                d[0] = static_cast<uchar>(s[x]);
+                d[1] = static_cast<uchar>(s[x] >> 8);
+                d[2] = static_cast<uchar>(s[x] >> 16);
+            }
+            break;
+        default:
+            dst = src.convertToFormat(dst.format());
+            return;
+        }
+    }
+}
+
+CaptureEngine::CaptureEngine(QObject *parent): QObject{parent}, m_ratio{1}, m_mixed{false}, m_primary{-1} {
+#ifdef Q_OS_LINUX
+    // 桌面和区域各用一个共享内存段，录制 GIF 时不会覆盖截图窗口正在使用的桌面图片
+    m_desktop = new XShmCapture;
+    m_region = new XShmCapture;
+    m_window = new WindowCapture;
+#endif // Q_OS_LINUX
+
+    auto *app = qobject_cast<QGuiApplication*>(QCoreApplication::instance());
+    if (app) {
+        connect(app, &QGuiApplication::screenAdded, this, [this](QScreen *screen) {
+            watchScreen(screen);
+            updateScreens();
+        });
+        connect(app, &QGuiApplication::screenRemoved, this, [this](QScreen *screen) {
+            disconnect(screen, nullptr, this, nullptr);
+            QMutexLocker locker{&m_mutex};
+            for (auto iter = m_screens.begin(); iter != m_screens.end(); ++iter) {
+                if (iter->screen == screen) {
+                    m_screens.erase(iter);
+                    break;
+                }
+            }
+            locker.unlock();
+            QMetaObject::invokeMethod(this, "updateScreens", Qt::QueuedConnection);
+        });
+        connect(app, &QGuiApplication::primaryScreenChanged, this, &CaptureEngine::updateScreens);
+        const QList<QScreen*> list = QGuiApplication::screens();
+        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+            watchScreen(*iter);
+        }
+    }
+    updateScreens();
+}
+
+CaptureEngine::~CaptureEngine() {
+#ifdef Q_OS_LINUX
+    if (m_standby_thread.joinable()) {
+        m_standby_thread.join();
+    }
+    m_standby = QImage();
+#endif // Q_OS_LINUX
+#ifdef Q_OS_LINUX
+    delete m_desktop;
+    m_desktop = nullptr;
+    delete m_region;
+    m_region = nullptr;
+    delete m_window;
+    m_window = nullptr;
+#endif // Q_OS_LINUX
+}
+
+CaptureEngine* CaptureEngine::instance() {
+    static CaptureEngine self;
+    return &self;
+}
+
+QVector<CaptureEngine::ScreenInfo> CaptureEngine::screens() const {
+    QMutexLocker locker{&m_mutex};
+    return m_screens;
+}
+
+QSize CaptureEngine::desktopSize() const {
+    QMutexLocker locker{&m_mutex};
+    return m_desktop_size;
+}
+
+QSize CaptureEngine::logicalSize() const {
+    QMutexLocker locker{&m_mutex};
+    return m_logical_size;
+}
+
+qreal CaptureEngine::ratio() const {
+    QMutexLocker locker{&m_mutex};
+    return m_ratio;
+}
+
+QPoint CaptureEngine::toScreenPoint(const QPoint &point, qreal ratio) const {
+    if (ratio == 1) return point;
+
+    QPoint pos = point * ratio;
+    QMutexLocker locker{&m_mutex};
+    const ScreenInfo *target = nullptr;
+    for (auto iter = m_screens.cbegin(); iter != m_screens.cend(); ++iter) {
+        if (iter->native.contains(pos)) {
+            target = &(*iter);
+            break;
+        }
+    }
+    if (! target) {
+        if (m_primary < 0 || m_primary >= m_screens.size()) return point;
+        target = &m_screens[m_primary];
+    }
+
+    const QRect &targetRect = target->geometry;
+    int x = (pos.x() - targetRect.left()) / ratio + targetRect.left();
+    int y = (pos.y() - targetRect.top()) / ratio + targetRect.top();
+
+    return {x, y};
+}
+
+QRect CaptureEngine::toScreenRect(const QRect &rect, qreal ratio) const {
+    if (ratio == 1) return rect;
+
+    return {toScreenPoint(rect.topLeft(), ratio), rect.size()};
+}
+
+QRect CaptureEngine::toNativeRect(const QRect &rect, qreal ratio) const {
+    QRect native{rect.topLeft(), QSize(rect.width() * ratio, rect.height() * ratio)};
+    QMutexLocker locker{&m_mutex};
+    for (auto iter = m_screens.cbegin(); iter != m_screens.cend(); ++iter) {
+        if (iter->native.contains(native)) {
+            QPoint offset = rect.topLeft() - iter->native.topLeft();
+            native.moveTopLeft(iter->native.topLeft() + offset * ratio);
+            break;
+        }
+    }
+    return native;
+}
+
+QImage CaptureEngine::grabDesktop() {
+    QElapsedTimer timer;
+    timer.start();
+    const QSize size = desktopSize();
+    QImage image;
+#ifdef Q_OS_LINUX
+    // 根窗口的物理像素与下面拼接出来的图片一致，直接从共享内存读取
+    if (m_desktop->isValid()) {
+        image = m_desktop->grab(QRect{QPoint{0, 0}, size});
+        if (image.size() != size) {
+            image = QImage();
+        }
+    }
+#endif // Q_OS_LINUX
+    if (image.isNull()) {
+        image = acquire(size, QImage::Format_ARGB32);
+        QPainter painter(&image);
+        const QVector<ScreenInfo> list = screens();
+        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+            painter.drawPixmap(iter->native, iter->screen->grabWindow(0));
+        }
+        painter.end();
+    }
+    record(Kind::Desktop, timer.nsecsElapsed());
+    return image;
+}
+
+QImage CaptureEngine::grabRegion(const QRect &rect, QImage::Format format) {
+    if (rect.isEmpty()) return {};
+    QElapsedTimer timer;
+    timer.start();
+    QImage image;
+#ifdef Q_OS_LINUX
+    image = grabShm(rect, format);
+#endif // Q_OS_LINUX
+    if (image.isNull()) {
+        const QVector<ScreenInfo> list = screens();
+        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+            if (iter->native.contains(rect)) {
+                QPoint offset = (rect.topLeft() - iter->native.topLeft()) / iter->ratio;
+                QImage source = iter->screen->grabWindow(0, offset.x(), offset.y(),
+                                                         qRound(rect.width() / iter->ratio),
+                                                         qRound(rect.height() / iter->ratio)).toImage();
+                if (source.depth() != 32) {
+                    source = source.convertToFormat(QImage::Format_RGB32);
+                }
+                image = acquire(source.size(), format);
+                copyPixels(source, image);
+                break;
+            }
+        }
+    }
+    if (image.isNull()) {
+        // 跨屏幕时只绘制与区域相交的屏幕
+        image = acquire(rect.size(), format);
+        QPainter painter(&image);
+        painter.translate(- rect.topLeft());
+        const QVector<ScreenInfo> list = screens();
+        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+            if (iter->native.intersects(rect)) {
+                painter.drawPixmap(iter->native, iter->screen->grabWindow(0));
+            }
+        }
+        painter.end();
+    }
+    record(Kind::Region, timer.nsecsElapsed());
+    return image;
+}
+
+bool CaptureEngine::perScreenFrames() const {
+#ifdef Q_OS_LINUX
+    // 根窗口本身就是各屏幕物理像素拼接的结果，一次读取即可
+    if (m_desktop->isValid()) return false;
+#endif // Q_OS_LINUX
+    QMutexLocker locker{&m_mutex};
+    return m_mixed;
+}
+
+DesktopImage CaptureEngine::grabScreens() {
+    if (! perScreenFrames()) {
+        return DesktopImage{grabDesktop()};
+    }
+    QElapsedTimer timer;
+    timer.start();
+    DesktopImage image{desktopSize()};
+    const QVector<ScreenInfo> list = screens();
+    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+        QImage frame = iter->screen->grabWindow(0).toImage();
+        if (frame.depth() != 32) {
+            frame = frame.convertToFormat(QImage::Format_RGB32);
+        }
+        // 保持屏幕的物理分辨率，坐标换算由 DesktopImage 处理
+        frame.setDevicePixelRatio(1);
+        image.addFrame(iter->native, frame);
+    }
+    record(Kind::Desktop, timer.nsecsElapsed());
+    return image;
+}
+
+DesktopImage CaptureEngine::acquireScreens(QImage::Format format) {
+    if (! perScreenFrames()) {
+        return DesktopImage{acquire(desktopSize(), format)};
+    }
+    DesktopImage image{desktopSize()};
+    const QVector<ScreenInfo> list = screens();
+    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+        image.addFrame(iter->native, acquire(iter->native.size(), format));
+    }
+    return image;
+}
+
+bool CaptureEngine::grabInto(QImage &image, const QRect &rect) {
+    if (rect.isEmpty() || image.size() != rect.size() || image.depth() != 32) return false;
+#ifdef Q_OS_LINUX
+    if (m_region->isValid() && (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32 ||
+                                image.format() == QImage::Format_ARGB32_Premultiplied)) {
+        QElapsedTimer timer;
+        timer.start();
+        QMutexLocker locker{&m_region_mutex};
+        QImage source = m_region->grab(rect);
+        if (! source.isNull()) {
+            copyPixels(source, image);
+            locker.unlock();
+            record(Kind::Region, timer.nsecsElapsed());
+            return true;
+        }
+    }
+#endif // Q_OS_LINUX
+    QImage source = grabRegion(rect, image.format());
+    if (source.isNull()) return false;
+    const int height = qMin(source.height(), image.height());
+    const size_t bytes = static_cast<size_t>(qMin(source.width(), image.width())) * 4;
+    for (int y = 0; y < height; ++y) {
+        memcpy(image.scanLine(y), source.constScanLine(y), bytes);
+    }
+    return true;
+}
+
+#ifdef Q_OS_LINUX
+QImage CaptureEngine::grabShm(const QRect &rect, QImage::Format format) {
+    if (! m_region->isValid()) return {};
+    QMutexLocker locker{&m_region_mutex};
+    QImage source = m_region->grab(rect);
+    if (source.isNull()) return {};
+    QImage image = acquire(source.size(), format);
+    copyPixels(source, image);
+    return image;
+}
+
+void CaptureEngine::prepareStandby() {
+    // 只有共享内存后端可以在其他线程截图
+    if (! m_region->isValid() || m_standby_busy) return;
+    if (m_standby_thread.joinable()) {
+        m_standby_thread.join();
+    }
+    m_standby_busy = true;
+    const QRect desktop{QPoint{0, 0}, desktopSize()};
+    const quint64 generation = m_standby_generation;
+    m_standby_thread = std::thread([this, desktop, generation]() {
+        // 失败时不能退回 QScreen::grabWindow，它只能在界面线程调用
+        QElapsedTimer timer;
+        timer.start();
+        QImage image = grabShm(desktop, QImage::Format_RGB32);
+        if (! image.isNull()) {
+            record(Kind::Region, timer.nsecsElapsed());
+        }
+        QMutexLocker locker{&m_standby_mutex};
+        // 截图期间调用过 discardStandby 时丢弃结果
+        if (generation == m_standby_generation) {
+            m_standby = image;
+            m_standby_time.start();
+        }
+        locker.unlock();
+        m_standby_busy = false;
+    });
+}
+
+QImage CaptureEngine::takeStandby(qint64 maxAge) {
+    if (m_standby_thread.joinable()) {
+        m_standby_thread.join();
+    }
+    QMutexLocker locker{&m_standby_mutex};
+    QImage image;
+    std::swap(image, m_standby);
+    // 屏幕布局变化或者按住修饰键太久时内容已经过时
+    if (image.isNull() || image.size() != desktopSize() || m_standby_time.elapsed() > maxAge) {
+        return {};
+    }
+    return image;
+}
+
+void CaptureEngine::discardStandby() {
+    QMutexLocker locker{&m_standby_mutex};
+    ++m_standby_generation;
+    m_standby = QImage();
+}
+
+QImage CaptureEngine::grabWindow(unsigned long window) {
+    if (!m_window->isValid()) return {};
+    QElapsedTimer timer;
+    timer.start();
+    QImage image = m_window->grab(window);
+    if (!image.isNull()) {
+        record(Kind::Window, timer.nsecsElapsed());
+    }
+    return image;
+}
+#endif // Q_OS_LINUX
+
+QImage CaptureEngine::acquire(const QSize &size, QImage::Format format, ImagePool::Owner owner) {
+    return ImagePool::instance()->acquire(size, format, owner);
+}
+
+CaptureEngine::Stats CaptureEngine::stats(Kind kind) const {
+    QMutexLocker locker{&m_stats_mutex};
+    return m_stats[kind];
+}
+
+QString CaptureEngine::statsString() const {
+    static const char *names[KindCount] = {"desktop", "region", "window"};
+    QStringList list;
+    QMutexLocker locker{&m_stats_mutex};
+    for (int i = 0; i < KindCount; ++i) {
+        const Stats &s = m_stats[i];
+        if (s.count == 0) continue;
+        list << QString("%1: %2次 平均%3ms 最近%4ms 最大%5ms")
+                    .arg(names[i])
+                    .arg(s.count)
+                    .arg(s.total / 1e6 / s.count, 0, 'f', 2)
+                    .arg(s.last / 1e6, 0, 'f', 2)
+                    .arg(s.max / 1e6, 0, 'f', 2);
+    }
+    return list.join(", ");
+}
+
+void CaptureEngine::updateScreens() {
+    const QList<QScreen*> list = QGuiApplication::screens();
+    QScreen *primary = QGuiApplication::primaryScreen();
+    QVector<ScreenInfo> screens;
+    QSize size;
+    QSize logical;
+    qreal ratio = -1;
+    int index = -1;
+    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+        QRect rect = (*iter)->geometry();
+        qreal r = (*iter)->devicePixelRatio();
+        if (ratio == -1) {
+            ratio = r;
+        } else if (ratio != r) {
+            ratio = 0;
+        }
+        QRect native{rect.topLeft(), QSize(rect.width() * r, rect.height() * r)};
+        size.setWidth(qMax(native.right() + 1, size.width()));
+        size.setHeight(qMax(native.bottom() + 1, size.height()));
+        logical.setWidth(qMax(rect.right() + 1, logical.width()));
+        logical.setHeight(qMax(rect.bottom() + 1, logical.height()));
+        if (*iter == primary) {
+            index = screens.size();
+        }
+        screens.push_back({*iter, rect, native, r});
+    }
+    const bool mixed = ratio == 0;
+    if (ratio <= 0) ratio = 1;
+
+    QMutexLocker locker{&m_mutex};
+    m_screens = std::move(screens);
+    m_desktop_size = size;
+    m_logical_size = logical;
+    m_ratio = ratio;
+    m_mixed = mixed;
+    m_primary = index;
+    locker.unlock();
+    emit screensChanged();
+}
+
+void CaptureEngine::watchScreen(QScreen *screen) {
+    connect(screen, &QScreen::geometryChanged, this, &CaptureEngine::updateScreens, Qt::UniqueConnection);
+    connect(screen, &QScreen::logicalDotsPerInchChanged, this, &CaptureEngine::updateScreens, Qt::UniqueConnection);
+    connect(screen, &QScreen::physicalDotsPerInchChanged, this, &CaptureEngine::updateScreens, Qt::UniqueConnection);
+}
+
+void CaptureEngine::record(Kind kind, qint64 nsecs) {
+    QMutexLocker locker{&m_stats_mutex};
+    Stats &s = m_stats[kind];
+    ++s.count;
+    s.total += nsecs;
+    s.last = nsecs;
+    s.max = qMax(s.max, nsecs);
+}
@@ -0,0 +1,128 @@
+﻿#ifndef CAPTUREENGINE_H
+#define CAPTUREENGINE_H
+
+#include <QObject>
+#include <QImage>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+#include "DesktopImage.h"
+#include "ImagePool.h"
+#ifdef Q_OS_LINUX
+#include <atomic>
+#include <thread>
+#endif // Q_OS_LINUX
+
+class QScreen;
+#ifdef Q_OS_LINUX
+class XShmCapture;
+class WindowCapture;
+#endif // Q_OS_LINUX
+
+// 统一的截图入口：缓存屏幕布局，屏幕增删或几何变化时更新（xcb 平台由 XRandR 通知触发），
+// 截图结果使用可回收的缓冲区，并统计每类截图的耗时
+class CaptureEngine : public QObject {
+    Q_OBJECT
+    explicit CaptureEngine(QObject *parent = nullptr);
+    Q_DISABLE_COPY_MOVE(CaptureEngine)
+
+public:
+    struct ScreenInfo {
+        QScreen *screen;
+        QRect geometry; // Qt 返回的坐标
+        QRect native;   // 物理像素坐标
+        qreal ratio;
+    };
+    enum Kind {
+        Desktop = 0,
+        Region,
+        Window,
+        KindCount
+    };
+    struct Stats {
+        quint64 count = 0;
+        qint64 total = 0; // 纳秒
+        qint64 last = 0;
+        qint64 max = 0;
+    };
+
+    ~CaptureEngine();
+    static CaptureEngine* instance();
+
+    QVector<ScreenInfo> screens() const;
+    QSize desktopSize() const;
+    QSize logicalSize() const;
+    // 所有屏幕缩放比例一致时返回该比例，否则返回 1
+    qreal ratio() const;
+    QPoint toScreenPoint(const QPoint &point, qreal ratio) const;
+    QRect toScreenRect(const QRect &rect, qreal ratio) const;
+    QRect toNativeRect(const QRect &rect, qreal ratio) const;
+
+    // 整个桌面，Linux 下与共享内存共用数据，下一次 grabDesktop 之前有效
+    QImage grabDesktop();
+    // rect 为物理像素坐标，结果写入回收池中的缓冲区
+    QImage grabRegion(const QRect &rect, QImage::Format format);
+    // 按屏幕分块截取整个桌面，只有一块时与 grabDesktop 共用数据
+    DesktopImage grabScreens();
+    // 与 grabScreens 分块方式相同的空白缓冲区
+    DesktopImage acquireScreens(QImage::Format format);
+    // 缩放比例不同并且不能直接读取根窗口时按屏幕分块，不拼接成一张图片
+    bool perScreenFrames() const;
+    // 把 rect 区域截图写入 image，image 为 32 位格式并且与 rect 大小相同，可以是其他图片的一部分
+    bool grabInto(QImage &image, const QRect &rect);
+    // 从 ImagePool 取出一块缓冲区，图片释放后自动归还
+    QImage acquire(const QSize &size, QImage::Format format, ImagePool::Owner owner = ImagePool::Capture);
+
+#ifdef Q_OS_LINUX
+    // 在后台线程预先截取整个桌面，热键按完后由 takeStandby 取出
+    void prepareStandby();
+    // 返回 maxAge 毫秒内预先截取的桌面，没有时返回空图片，后台线程还在截图时等待它完成
+    QImage takeStandby(qint64 maxAge);
+    void discardStandby();
+    // 直接读取 window 自己的内容（需要合成器），不可用时返回空图片
+    QImage grabWindow(unsigned long window);
+    // 只用共享内存截图，可以在其他线程调用，失败时返回空图片
+    QImage grabShm(const QRect &rect, QImage::Format format);
+#endif // Q_OS_LINUX
+
+    Stats stats(Kind kind) const;
+    QString statsString() const;
+
+signals:
+    void screensChanged();
+
+private slots:
+    void updateScreens();
+
+private:
+    void watchScreen(QScreen *screen);
+    void record(Kind kind, qint64 nsecs);
+
+    QVector<ScreenInfo> m_screens;
+    QSize m_desktop_size;
+    QSize m_logical_size;
+    qreal m_ratio;
+    bool m_mixed;
+    int m_primary;
+    mutable QMutex m_mutex;
+
+    Stats m_stats[KindCount];
+    mutable QMutex m_stats_mutex;
+
+#ifdef Q_OS_LINUX
+    XShmCapture *m_desktop;
+    XShmCapture *m_region;
+    QMutex m_region_mutex;
+    WindowCapture *m_window;
+
+    std::thread m_standby_thread;
+    std::atomic_bool m_standby_busy{false};
+    QImage m_standby;
+    QElapsedTimer m_standby_time;
+    // discardStandby 时加一（界面线程持有 m_standby_mutex 修改），后台线程只保存同一代的结果
+    quint64 m_standby_generation = 0;
+    QMutex m_standby_mutex;
+#endif // Q_OS_LINUX
+};
+
+#endif // CAPTUREENGINE_H
@@ -0,0 +1,176 @@
+﻿#include "CaptureExport.h"
+
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QFile>
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+CaptureExport::CaptureExport(QObject *parent): QObject{parent}, m_server{-1}, m_notifier{nullptr}, m_next_id{0} {
+}
+
+CaptureExport::~CaptureExport() {
+    stop();
+}
+
+bool CaptureExport::start() {
+    if (m_server != -1) return true;
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (dir.isEmpty()) {
+        qWarning() << "共享内存导出: 没有运行时目录";
+        return false;
+    }
+    m_path = dir + "/screenshot-export.sock";
+    const QByteArray path = QFile::encodeName(m_path);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (static_cast<size_t>(path.size()) >= sizeof(addr.sun_path)) {
+        qWarning() << "共享内存导出: socket 路径过长" << m_path;
+        return false;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    m_server = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_server == -1) {
+        qWarning() << "共享内存导出: 创建 socket 失败" << strerror(errno);
+        return false;
+    }
+    // 上次异常退出时留下的文件
+    unlink(path.constData());
+    if (bind(m_server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || listen(m_server, 8) == -1) {
+        qWarning() << "共享内存导出: 监听失败" << m_path << strerror(errno);
+        close(m_server);
+        m_server = -1;
+        return false;
+    }
+    // 运行时目录只有当前用户可以访问，socket 本身也只允许当前用户连接
+    chmod(path.constData(), 0600);
+    m_notifier = new QSocketNotifier(m_server, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &CaptureExport::accept);
+    qInfo() << "共享内存导出:" << m_path;
+    return true;
+}
+
+void CaptureExport::stop() {
+    if (m_server == -1) return;
+    const QList<int> clients = m_clients.keys();
+    for (int fd : clients) {
+        dropClient(fd);
+    }
+    delete m_notifier;
+    m_notifier = nullptr;
+    close(m_server);
+    m_server = -1;
+    unlink(QFile::encodeName(m_path).constData());
+}
+
+bool CaptureExport::isActive() const {
+    return m_server != -1;
+}
+
+QString CaptureExport::path() const {
+    return m_path;
+}
+
+bool CaptureExport::hasClients() const {
+    return ! m_clients.isEmpty();
+}
+
+void CaptureExport::publish(const DesktopImage &source, const QRect &rect, const QPoint &offset) {
+    if (m_clients.isEmpty() || rect.isEmpty() || source.isNull()) return;
+    const QImage::Format format = QImage::Format_RGB32;
+    const qsizetype stride = static_cast<qsizetype>(rect.width()) * 4;
+    const size_t size = static_cast<size_t>(stride) * rect.height();
+    const int send_fd = createSealed(source, rect, stride, size);
+    if (send_fd == -1) return;
+
+    const quint64 id = m_next_id++;
+    CaptureExportHeader header{captureExportMagic, captureExportVersion, id, rect.x() + offset.x(), rect.y() + offset.y(), rect.width(), rect.height(),
+                               static_cast<int32_t>(stride), static_cast<uint32_t>(format), size};
+    for (auto iter = m_clients.begin(); iter != m_clients.end(); ++iter) {
+        iovec iov{&header, sizeof(header)};
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &send_fd, sizeof(int));
+        // 客户端来不及接收时跳过这一张，不阻塞界面线程
+        sendmsg(iter.key(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    // 已经发出的 fd 由客户端持有，内存在所有 fd 关闭后释放
+    close(send_fd);
+}
+
+int CaptureExport::createSealed(const DesktopImage &source, const QRect &rect, qsizetype stride, size_t size) {
+    int fd = memfd_create("screenshot-export", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        qWarning() << "共享内存导出: memfd_create 失败" << strerror(errno);
+        return -1;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+        qWarning() << "共享内存导出: ftruncate 失败" << strerror(errno);
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        qWarning() << "共享内存导出: mmap 失败" << strerror(errno);
+        close(fd);
+        return -1;
+    }
+    // 直接写进共享内存，这是唯一的一次复制
+    QImage view{static_cast<uchar*>(data), rect.width(), rect.height(), stride, QImage::Format_RGB32};
+    source.copyTo(rect, view);
+    view = QImage();
+    // 可写的映射存在时不能加 F_SEAL_WRITE
+    munmap(data, size);
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        qWarning() << "共享内存导出: 封印 memfd 失败" << strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void CaptureExport::accept() {
+    int fd = accept4(m_server, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) return;
+    auto *notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, [this, fd]() { readClient(fd); });
+    m_clients.insert(fd, notifier);
+    qInfo() << "共享内存导出: 客户端连接" << fd;
+}
+
+void CaptureExport::readClient(int fd) {
+    // 只用来发现客户端断开（recv 返回 0 或出错），客户端发来的数据直接丢弃
+    char buffer[64];
+    while (true) {
+        ssize_t size = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (size <= 0) {
+            dropClient(fd);
+            return;
+        }
+    }
+}
+
+void CaptureExport::dropClient(int fd) {
+    auto iter = m_clients.find(fd);
+    if (iter == m_clients.end()) return;
+    (*iter)->deleteLater();
+    m_clients.erase(iter);
+    close(fd);
+    qInfo() << "共享内存导出: 客户端断开" << fd;
+}
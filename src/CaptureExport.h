@@ -0,0 +1,66 @@
+﻿#ifndef CAPTUREEXPORT_H
+#define CAPTUREEXPORT_H
+
+#include <QObject>
+#include <QHash>
+#include <QRect>
+#include <cstdint>
+
+#include "DesktopImage.h"
+
+class QSocketNotifier;
+
+// 通过 Unix socket（SOCK_SEQPACKET）把截图发给本机的其他进程：
+// 每张截图写入一个新的 memfd，写完后加上 F_SEAL_WRITE 等封印，内容之后不能再被任何进程修改，
+// 连同 CaptureExportHeader 一起用 SCM_RIGHTS 传给每个客户端，客户端直接 mmap，不编码也不复制；
+// 发送后本进程关闭自己的 fd，memfd 由内核按引用计数管理，所有客户端关闭 fd（或者退出）后自动释放，
+// 客户端不需要回复任何消息
+struct CaptureExportHeader {
+    uint32_t magic;   // captureExportMagic
+    uint32_t version; // captureExportVersion
+    uint64_t id;
+    int32_t x;        // 截图区域的物理像素坐标
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    int32_t stride;   // 每行字节数
+    uint32_t format;  // QImage::Format
+    uint64_t size;    // memfd 中有效数据的字节数
+};
+
+static constexpr uint32_t captureExportMagic = 0x58455353; // "SSEX"
+static constexpr uint32_t captureExportVersion = 1;
+
+class CaptureExport : public QObject {
+    Q_OBJECT
+public:
+    explicit CaptureExport(QObject *parent = nullptr);
+    ~CaptureExport();
+
+    // 在 $XDG_RUNTIME_DIR 下监听，失败时返回 false
+    bool start();
+    void stop();
+    bool isActive() const;
+    QString path() const;
+    bool hasClients() const;
+    // 把 source 的 rect 区域写入封印的共享内存发给所有客户端，没有客户端时直接返回
+    // 头部的坐标为 rect 加上 offset，即截图区域在桌面上的物理像素坐标
+    void publish(const DesktopImage &source, const QRect &rect, const QPoint &offset = {});
+
+private slots:
+    void accept();
+    void readClient(int fd);
+
+private:
+    // 创建并写入 memfd，封印后返回只能读取的 fd，失败时返回 -1
+    static int createSealed(const DesktopImage &source, const QRect &rect, qsizetype stride, size_t size);
+    void dropClient(int fd);
+
+    int m_server;
+    QString m_path;
+    QSocketNotifier *m_notifier;
+    QHash<int, QSocketNotifier*> m_clients;
+    quint64 m_next_id;
+};
+
+#endif // CAPTUREEXPORT_H
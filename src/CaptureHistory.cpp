@@ -0,0 +1,144 @@
+﻿#include "CaptureHistory.h"
+#include "ImagePool.h"
+
+#include <QElapsedTimer>
+#include <QDebug>
+
+// 托盘菜单里的缩略图大小
+static constexpr int thumbnailSize = 96;
+// 压缩速度优先，桌面截图大片同色，级别 1 已经能压到几分之一
+static constexpr int compressLevel = 1;
+
+CaptureHistory::CaptureHistory(QObject *parent): QObject{parent}, m_limit{10}, m_max_bytes{128LL * 1024 * 1024}, m_bytes{0}, m_next_id{0} {
+    m_thread = std::thread{&CaptureHistory::run, this};
+}
+
+CaptureHistory::~CaptureHistory() {
+    m_queue.close();
+    m_thread.join();
+    clear();
+}
+
+void CaptureHistory::setLimit(int count, qint64 bytes) {
+    QMutexLocker locker{&m_mutex};
+    m_limit = qMax(0, count);
+    m_max_bytes = qMax<qint64>(0, bytes);
+    evict(m_limit, m_max_bytes);
+    locker.unlock();
+    emit changed();
+}
+
+void CaptureHistory::add(const DesktopImage &desktop, const QRect &selection, qreal ratio) {
+    if (desktop.isNull()) return;
+    {
+        QMutexLocker locker{&m_mutex};
+        if (m_limit == 0 || m_max_bytes == 0) return;
+    }
+    // 桌面可能与共享内存共用数据，下次截图时会被覆盖，必须先复制
+    QImage image = ImagePool::instance()->acquire(desktop.size(), QImage::Format_RGB32, ImagePool::History);
+    if (image.isNull()) return;
+    desktop.copyTo(desktop.rect(), image);
+    m_queue.enqueue({std::move(image), {0, QDateTime::currentDateTime(), desktop.size(), selection, ratio, {}, 0}});
+}
+
+QVector<CaptureHistory::Entry> CaptureHistory::entries() const {
+    QVector<Entry> list;
+    QMutexLocker locker{&m_mutex};
+    list.reserve(m_items.size());
+    for (auto iter = m_items.crbegin(); iter != m_items.crend(); ++iter) {
+        list.append(iter->entry);
+    }
+    return list;
+}
+
+QImage CaptureHistory::restore(quint64 id) const {
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker{&m_mutex};
+    auto iter = m_items.cbegin();
+    while (iter != m_items.cend() && iter->entry.id != id) {
+        ++iter;
+    }
+    if (iter == m_items.cend()) return {};
+    // 压缩数据是隐式共享的，解压时不需要持有锁
+    const QByteArray data = iter->data;
+    const QSize size = iter->entry.size;
+    const QImage::Format format = iter->format;
+    const qsizetype bytesPerLine = iter->bytesPerLine;
+    locker.unlock();
+
+    // 图片直接使用解压出来的数组，不再复制
+    auto *array = new QByteArray{qUncompress(data)};
+    if (array->size() < bytesPerLine * size.height()) {
+        qWarning() << "截图历史解压失败" << id;
+        delete array;
+        return {};
+    }
+    QImage image{reinterpret_cast<uchar*>(array->data()), size.width(), size.height(), bytesPerLine, format,
+                 [](void *info) { delete static_cast<QByteArray*>(info); }, array};
+    qDebug() << QString("恢复截图历史 %1: %2ms").arg(id).arg(timer.nsecsElapsed() / 1e6, 0, 'f', 2);
+    return image;
+}
+
+int CaptureHistory::count() const {
+    QMutexLocker locker{&m_mutex};
+    return m_items.size();
+}
+
+qint64 CaptureHistory::bytes() const {
+    QMutexLocker locker{&m_mutex};
+    return m_bytes;
+}
+
+void CaptureHistory::clear() {
+    QMutexLocker locker{&m_mutex};
+    evict(0, 0);
+}
+
+void CaptureHistory::shrink() {
+    QMutexLocker locker{&m_mutex};
+    const int count = m_items.size() / 2;
+    evict(count, count == 0 ? 0 : m_bytes);
+    locker.unlock();
+    emit changed();
+}
+
+void CaptureHistory::run() {
+    Task task;
+    while (m_queue.dequeue(&task)) {
+        QElapsedTimer timer;
+        timer.start();
+        const QImage &image = task.image;
+        Item item{task.entry, {}, image.format(), image.bytesPerLine()};
+        // 直接引用图片的数据，不复制
+        item.data = qCompress(QByteArray::fromRawData(reinterpret_cast<const char*>(image.constBits()), image.sizeInBytes()), compressLevel);
+        item.entry.thumbnail = image.scaled(thumbnailSize, thumbnailSize, Qt::KeepAspectRatio, Qt::FastTransformation);
+        item.entry.bytes = item.data.size() + item.entry.thumbnail.sizeInBytes();
+        const qint64 raw = image.sizeInBytes();
+        task.image = QImage();
+        qDebug() << QString("压缩截图历史: %1MB -> %2MB, %3ms")
+                        .arg(raw / 1048576.0, 0, 'f', 1)
+                        .arg(item.data.size() / 1048576.0, 0, 'f', 1)
+                        .arg(timer.nsecsElapsed() / 1e6, 0, 'f', 2);
+
+        QMutexLocker locker{&m_mutex};
+        if (m_limit == 0 || item.entry.bytes > m_max_bytes) continue;
+        item.entry.id = m_next_id++;
+        // 先给新的腾出位置
+        evict(m_limit - 1, m_max_bytes - item.entry.bytes);
+        m_bytes += item.entry.bytes;
+        ImagePool::instance()->account(ImagePool::History, item.entry.bytes);
+        m_items.append(std::move(item));
+        locker.unlock();
+        emit changed();
+    }
+}
+
+void CaptureHistory::evict(int count, qint64 bytes) {
+    while (! m_items.isEmpty() && (m_items.size() > count || m_bytes > bytes)) {
+        const qint64 size = m_items.first().entry.bytes;
+        m_items.removeFirst();
+        m_bytes -= size;
+        ImagePool::instance()->account(ImagePool::History, - size);
+    }
+}
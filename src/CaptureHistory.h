@@ -0,0 +1,77 @@
+﻿#ifndef CAPTUREHISTORY_H
+#define CAPTUREHISTORY_H
+
+#include <QObject>
+#include <QImage>
+#include <QDateTime>
+#include <QVector>
+#include <QMutex>
+#include <thread>
+
+#include "BlockQueue.h"
+#include "DesktopImage.h"
+
+// 最近几次截图的桌面，在后台线程用 zlib 最快的级别压缩后保存在内存中，
+// 超过数量或者内存上限时丢弃最旧的；压缩后的大小计入 ImagePool 的统计
+class CaptureHistory : public QObject {
+    Q_OBJECT
+public:
+    struct Entry {
+        quint64 id;
+        QDateTime time;
+        QSize size;
+        // 结束截图时的选区（图片像素坐标），没有选区时为空
+        QRect selection;
+        qreal ratio;
+        QImage thumbnail;
+        qint64 bytes;
+    };
+
+    explicit CaptureHistory(QObject *parent = nullptr);
+    ~CaptureHistory();
+
+    // count 为 0 时不保存历史
+    void setLimit(int count, qint64 bytes);
+    // 在调用线程复制一份桌面，压缩在后台进行
+    void add(const DesktopImage &desktop, const QRect &selection, qreal ratio);
+    // 从新到旧排列
+    QVector<Entry> entries() const;
+    // 解压出完整的桌面，找不到时返回空图片
+    QImage restore(quint64 id) const;
+    int count() const;
+    qint64 bytes() const;
+    void clear();
+
+signals:
+    void changed();
+
+public slots:
+    // 图片内存超出预算时丢掉较旧的一半
+    void shrink();
+
+private:
+    struct Task {
+        QImage image;
+        Entry entry;
+    };
+    struct Item {
+        Entry entry;
+        QByteArray data;
+        QImage::Format format;
+        qsizetype bytesPerLine;
+    };
+    void run();
+    // 调用时需要持有 m_mutex
+    void evict(int count, qint64 bytes);
+
+    BlockQueue<Task> m_queue;
+    std::thread m_thread;
+    QVector<Item> m_items;
+    int m_limit;
+    qint64 m_max_bytes;
+    qint64 m_bytes;
+    quint64 m_next_id;
+    mutable QMutex m_mutex;
+};
+
+#endif // CAPTUREHISTORY_H
@@ -0,0 +1,160 @@
+﻿#include "DamageMonitor.h"
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+
+struct DamageMonitor::Private {
+    Display *display = nullptr;
+    Window root = 0;
+    Damage damage = 0;
+    bool valid = false;
+};
+
+DamageMonitor::DamageMonitor(): d{new Private}, m_next_id{0}, m_notifier{nullptr} {
+    d->display = XOpenDisplay(nullptr);
+    if (d->display == nullptr) {
+        qWarning() << "XDamage: 无法打开display";
+        return;
+    }
+    int event, error;
+    if (! XDamageQueryExtension(d->display, &event, &error)) {
+        qWarning() << "XDamage: 不支持DAMAGE扩展";
+        return;
+    }
+    if (! XFixesQueryExtension(d->display, &event, &error)) {
+        qWarning() << "XDamage: 不支持XFIXES扩展";
+        return;
+    }
+    d->root = DefaultRootWindow(d->display);
+    d->valid = true;
+}
+
+DamageMonitor::~DamageMonitor() {
+    if (d->display != nullptr) {
+        destroyDamage();
+        XCloseDisplay(d->display);
+        d->display = nullptr;
+    }
+    delete d;
+    d = nullptr;
+}
+
+DamageMonitor* DamageMonitor::instance() {
+    static DamageMonitor self;
+    return &self;
+}
+
+bool DamageMonitor::isValid() const {
+    return d->valid;
+}
+
+int DamageMonitor::subscribe(const QRect &rect, std::function<void()> notify) {
+    QVector<std::function<void()>> wake;
+    QMutexLocker locker{&m_mutex};
+    if (! d->valid || rect.isEmpty()) return -1;
+    if (m_subscribers.isEmpty()) {
+        createDamage();
+    } else {
+        // 先把已有的变化分给其他订阅者，新订阅者从当前时刻开始统计
+        collect(wake);
+    }
+    int id = m_next_id++;
+    m_subscribers.insert(id, {rect, {}, std::move(notify)});
+    locker.unlock();
+    for (auto iter = wake.cbegin(); iter != wake.cend(); ++iter) {
+        (*iter)();
+    }
+    return id;
+}
+
+void DamageMonitor::unsubscribe(int id) {
+    QMutexLocker locker{&m_mutex};
+    if (m_subscribers.remove(id) > 0 && m_subscribers.isEmpty()) {
+        destroyDamage();
+    }
+}
+
+QRegion DamageMonitor::take(int id) {
+    QVector<std::function<void()>> wake;
+    QMutexLocker locker{&m_mutex};
+    auto iter = m_subscribers.find(id);
+    if (iter == m_subscribers.end()) return {};
+    collect(wake);
+    QRegion region = iter->dirty;
+    iter->dirty = QRegion{};
+    locker.unlock();
+    for (auto iter = wake.cbegin(); iter != wake.cend(); ++iter) {
+        (*iter)();
+    }
+    return region;
+}
+
+void DamageMonitor::dispatch() {
+    QVector<std::function<void()>> wake;
+    QMutexLocker locker{&m_mutex};
+    collect(wake);
+    // 读取回复时顺带读进来的事件不会再触发 socket 通知，留到下一轮处理
+    if (m_notifier != nullptr && XQLength(d->display) > 0) {
+        QMetaObject::invokeMethod(m_notifier, [this]() { dispatch(); }, Qt::QueuedConnection);
+    }
+    locker.unlock();
+    for (auto iter = wake.cbegin(); iter != wake.cend(); ++iter) {
+        (*iter)();
+    }
+}
+
+void DamageMonitor::collect(QVector<std::function<void()>> &wake) {
+    // 使用 XDamageReportNonEmpty，区域从空变为非空时才有通知事件，
+    // 没有事件说明上次取走之后没有变化，不需要往返服务端
+    if (XEventsQueued(d->display, QueuedAfterReading) == 0) return;
+    // 只用区域本身，通知事件直接丢弃，必须在取区域之前丢弃，之后到达的事件留给下一次
+    while (XPending(d->display) > 0) {
+        XEvent event;
+        XNextEvent(d->display, &event);
+    }
+    if (d->damage == 0) return;
+    XserverRegion parts = XFixesCreateRegion(d->display, nullptr, 0);
+    XDamageSubtract(d->display, d->damage, None, parts);
+    int count = 0;
+    XRectangle *rects = XFixesFetchRegion(d->display, parts, &count);
+    XFixesDestroyRegion(d->display, parts);
+    if (rects == nullptr) return;
+
+    for (auto iter = m_subscribers.begin(); iter != m_subscribers.end(); ++iter) {
+        const QRect &bound = iter->rect;
+        const bool empty = iter->dirty.isEmpty();
+        for (int i = 0; i < count; ++i) {
+            QRect rect = QRect{rects[i].x, rects[i].y, rects[i].width, rects[i].height}.intersected(bound);
+            if (! rect.isEmpty()) {
+                iter->dirty += rect.translated(-bound.topLeft());
+            }
+        }
+        if (empty && ! iter->dirty.isEmpty() && iter->notify) {
+            wake.append(iter->notify);
+        }
+    }
+    XFree(rects);
+}
+
+void DamageMonitor::createDamage() {
+    if (d->damage != 0) return;
+    d->damage = XDamageCreate(d->display, d->root, XDamageReportNonEmpty);
+    XSync(d->display, False);
+    if (m_notifier == nullptr) {
+        m_notifier = new QSocketNotifier(ConnectionNumber(d->display), QSocketNotifier::Read);
+        QObject::connect(m_notifier, &QSocketNotifier::activated, m_notifier, [this]() { dispatch(); });
+    }
+}
+
+void DamageMonitor::destroyDamage() {
+    if (d->damage == 0) return;
+    // 可能正在 socket 通知里
+    m_notifier->deleteLater();
+    m_notifier = nullptr;
+    XDamageDestroy(d->display, d->damage);
+    XSync(d->display, False);
+    d->damage = 0;
+}
@@ -0,0 +1,50 @@
+﻿#ifndef DAMAGEMONITOR_H
+#define DAMAGEMONITOR_H
+
+#include <QHash>
+#include <QMutex>
+#include <QRect>
+#include <QRegion>
+#include <QVector>
+#include <functional>
+
+class QSocketNotifier;
+
+// 通过 XDamage 监听根窗口的变化区域，多个订阅者共用一个 damage 对象，
+// 没有订阅者时销毁 damage，不占用 X 服务端资源；没有变化时不往返服务端，
+// 监听连接的 socket，有变化时通知订阅者
+class DamageMonitor {
+    DamageMonitor();
+    Q_DISABLE_COPY_MOVE(DamageMonitor)
+public:
+    ~DamageMonitor();
+    static DamageMonitor* instance();
+
+    bool isValid() const;
+    // rect 为根窗口的物理像素坐标，不支持 XDamage 时返回 -1
+    // notify 在主线程调用，区域从没有变化到有变化时通知一次，之后调用 take 才会再次通知
+    int subscribe(const QRect &rect, std::function<void()> notify = {});
+    void unsubscribe(int id);
+    // 返回上次调用之后 rect 内变化的区域，坐标相对于 rect 左上角
+    QRegion take(int id);
+
+private:
+    struct Subscriber {
+        QRect rect;
+        QRegion dirty;
+        std::function<void()> notify;
+    };
+    void dispatch();
+    void collect(QVector<std::function<void()>> &wake);
+    void createDamage();
+    void destroyDamage();
+
+    struct Private;
+    Private *d;
+    QHash<int, Subscriber> m_subscribers;
+    int m_next_id;
+    QSocketNotifier *m_notifier;
+    QMutex m_mutex;
+};
+
+#endif // DAMAGEMONITOR_H
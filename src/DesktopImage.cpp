@@ -0,0 +1,110 @@
+﻿#include "DesktopImage.h"
+
+#include <QPainter>
+#include <cstring>
+
+DesktopImage::DesktopImage(const QImage &image): m_size{image.size()} {
+    if (! image.isNull()) {
+        m_frames.push_back({image.rect(), image});
+    }
+}
+
+DesktopImage::DesktopImage(const QSize &size): m_size{size} {}
+
+void DesktopImage::addFrame(const QRect &rect, const QImage &image) {
+    if (image.isNull()) return;
+    m_frames.push_back({QRect{rect.topLeft(), image.size()}, image});
+}
+
+void DesktopImage::clear() {
+    m_frames.clear();
+    m_size = QSize();
+}
+
+const DesktopImage::Frame* DesktopImage::find(const QRect &rect) const {
+    for (auto iter = m_frames.cbegin(); iter != m_frames.cend(); ++iter) {
+        if (iter->rect.contains(rect)) return &(*iter);
+    }
+    return nullptr;
+}
+
+QImage DesktopImage::view(const QRect &rect) {
+    for (auto iter = m_frames.begin(); iter != m_frames.end(); ++iter) {
+        if (iter->rect.contains(rect)) {
+            QImage &image = iter->image;
+            const QPoint offset = rect.topLeft() - iter->rect.topLeft();
+            return QImage(image.bits() + offset.y() * image.bytesPerLine() + offset.x() * image.depth() / 8,
+                          rect.width(), rect.height(), image.bytesPerLine(), image.format());
+        }
+    }
+    return {};
+}
+
+QImage DesktopImage::constView(const QRect &rect) const {
+    const Frame *frame = find(rect);
+    if (! frame) return {};
+    const QImage &image = frame->image;
+    const QPoint offset = rect.topLeft() - frame->rect.topLeft();
+    return QImage(image.constBits() + offset.y() * image.bytesPerLine() + offset.x() * image.depth() / 8,
+                  rect.width(), rect.height(), image.bytesPerLine(), image.format());
+}
+
+void DesktopImage::draw(QPainter &painter, const QRectF &target, const QRectF &source) const {
+    if (source.isEmpty()) return;
+    const qreal sx = target.width() / source.width();
+    const qreal sy = target.height() / source.height();
+    for (auto iter = m_frames.cbegin(); iter != m_frames.cend(); ++iter) {
+        const QRectF part = source.intersected(QRectF(iter->rect));
+        if (part.isEmpty()) continue;
+        const QRectF dst{target.left() + (part.left() - source.left()) * sx,
+                         target.top() + (part.top() - source.top()) * sy,
+                         part.width() * sx, part.height() * sy};
+        painter.drawImage(dst, iter->image, part.translated(- iter->rect.topLeft()));
+    }
+}
+
+QColor DesktopImage::pixelColor(const QPoint &point) const {
+    const Frame *frame = find(QRect{point, QSize{1, 1}});
+    if (! frame) return {};
+    return frame->image.pixelColor(point - frame->rect.topLeft());
+}
+
+QImage DesktopImage::copy(const QRect &rect) const {
+    if (m_frames.isEmpty()) return {};
+    // 只有一块或者区域在某个屏幕内时直接复制
+    const Frame *frame = m_frames.size() == 1 ? &m_frames.first() : find(rect);
+    if (frame) {
+        return frame->image.copy(rect.translated(- frame->rect.topLeft()));
+    }
+    QImage image{rect.size(), m_frames.first().image.format()};
+    copyTo(rect, image);
+    return image;
+}
+
+void DesktopImage::copyTo(const QRect &rect, QImage &dst) const {
+    if (m_frames.isEmpty() || dst.size() != rect.size()) return;
+    const Frame *frame = find(rect);
+    if (frame && frame->image.format() == dst.format()) {
+        const int bpp = dst.depth() / 8;
+        const QPoint offset = rect.topLeft() - frame->rect.topLeft();
+        for (int y = 0; y < rect.height(); ++y) {
+            memcpy(dst.scanLine(y), frame->image.constScanLine(offset.y() + y) + offset.x() * bpp, static_cast<size_t>(rect.width()) * bpp);
+        }
+        return;
+    }
+    dst.fill(0);
+    QPainter painter(&dst);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (auto iter = m_frames.cbegin(); iter != m_frames.cend(); ++iter) {
+        const QRect part = rect.intersected(iter->rect);
+        if (part.isEmpty()) continue;
+        painter.drawImage(part.topLeft() - rect.topLeft(), iter->image, part.translated(- iter->rect.topLeft()));
+    }
+    painter.end();
+}
+
+QBrush DesktopImage::brush(const QRect &rect) const {
+    QBrush brush{copy(rect)};
+    brush.setTransform(QTransform::fromTranslate(rect.left(), rect.top()));
+    return brush;
+}
@@ -0,0 +1,53 @@
+﻿#ifndef DESKTOPIMAGE_H
+#define DESKTOPIMAGE_H
+
+#include <QImage>
+#include <QVector>
+#include <QBrush>
+
+class QPainter;
+
+// 按屏幕分块保存的桌面截图，坐标都是整个桌面的物理像素坐标
+// 各屏幕缩放比例一致时只有一块；比例不同时每个屏幕一块，保持各自的原始分辨率，
+// 读取单个屏幕内的区域直接使用对应的分块，只有跨屏的区域才拼接
+class DesktopImage {
+public:
+    struct Frame {
+        QRect rect;
+        QImage image;
+    };
+
+    DesktopImage() = default;
+    explicit DesktopImage(const QImage &image);
+    explicit DesktopImage(const QSize &size);
+
+    void addFrame(const QRect &rect, const QImage &image);
+    void clear();
+    inline bool isNull() const { return m_frames.isEmpty(); }
+    inline QSize size() const { return m_size; }
+    inline int width() const { return m_size.width(); }
+    inline int height() const { return m_size.height(); }
+    inline QRect rect() const { return {QPoint{0, 0}, m_size}; }
+    inline const QVector<Frame>& frames() const { return m_frames; }
+
+    // rect 在单个分块内时返回直接指向该分块数据的图片，否则返回空图片
+    QImage view(const QRect &rect);
+    QImage constView(const QRect &rect) const;
+    // 把 source 区域画到 target，不在任何分块内的部分不绘制
+    void draw(QPainter &painter, const QRectF &target, const QRectF &source) const;
+    QColor pixelColor(const QPoint &point) const;
+    QImage copy(const QRect &rect) const;
+    // 写入已经分配好的 dst，dst 与 rect 大小相同，不在任何分块内的部分填充为 0
+    void copyTo(const QRect &rect, QImage &dst) const;
+    inline QImage copy(int x, int y, int width, int height) const { return copy(QRect(x, y, width, height)); }
+    // 以 rect 区域为纹理的画刷，纹理放在桌面坐标的对应位置
+    QBrush brush(const QRect &rect) const;
+
+private:
+    const Frame* find(const QRect &rect) const;
+
+    QVector<Frame> m_frames;
+    QSize m_size;
+};
+
+#endif // DESKTOPIMAGE_H
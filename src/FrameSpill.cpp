@@ -0,0 +1,251 @@
+﻿#include "FrameSpill.h"
+#include "ImagePool.h"
+
+#include <QDebug>
+#include <cstring>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#endif // Q_OS_UNIX
+
+// 录屏时相邻帧大部分相同，异或后几乎都是 0，级别 1 已经足够
+static constexpr int compressLevel = 1;
+// 等待压缩的帧数上限，超过时由调用方丢帧
+static constexpr int maxPendingFrames = 4;
+
+FrameSpill::FrameSpill(): m_map{nullptr}, m_capacity{0}, m_head{0}, m_used{0}, m_next_seq{0}, m_closed{false} {
+}
+
+FrameSpill::~FrameSpill() {
+    {
+        QMutexLocker locker{&m_mutex};
+        m_closed = true;
+        m_cond.wakeAll();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_map != nullptr) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    if (m_file.isOpen()) {
+        m_file.close();
+        m_file.remove();
+    }
+}
+
+bool FrameSpill::open(const QString &path, qint64 capacity) {
+    if (capacity <= 0) return false;
+    m_file.setFileName(path);
+    if (! m_file.open(QFile::ReadWrite | QFile::Truncate)) {
+        qWarning() << "创建GIF溢出文件失败" << path << m_file.errorString();
+        return false;
+    }
+    bool allocated = m_file.resize(capacity);
+#ifdef Q_OS_UNIX
+    // resize 只得到稀疏文件，写映射时磁盘满会收到 SIGBUS，必须先真正分配
+    allocated = allocated && posix_fallocate(m_file.handle(), 0, capacity) == 0;
+#endif // Q_OS_UNIX
+    if (! allocated || (m_map = m_file.map(0, capacity)) == nullptr) {
+        qWarning() << "分配GIF溢出文件失败" << path << capacity << m_file.errorString();
+        m_file.close();
+        m_file.remove();
+        return false;
+    }
+    m_capacity = capacity;
+    m_thread = std::thread{&FrameSpill::run, this};
+    return true;
+}
+
+bool FrameSpill::isOpen() const {
+    return m_map != nullptr;
+}
+
+bool FrameSpill::push(const uchar *data, qsizetype size, Handle *handle) {
+    if (m_map == nullptr) return false;
+    QMutexLocker locker{&m_mutex};
+    if (m_jobs.size() >= maxPendingFrames) return false;
+    const quint64 seq = m_next_seq++;
+    m_records.enqueue({seq, Pending, false, -1, 0});
+    m_jobs.enqueue({seq, QByteArray{reinterpret_cast<const char*>(data), size}});
+    m_cond.wakeAll();
+    locker.unlock();
+    ImagePool::instance()->account(ImagePool::Gif, size);
+    *handle = {this, seq};
+    return true;
+}
+
+QByteArray FrameSpill::take(const Handle &handle) {
+    QMutexLocker locker{&m_mutex};
+    if (m_records.isEmpty() || m_records.head().seq != handle.seq) {
+        qWarning() << "GIF溢出帧没有按顺序读取" << handle.seq;
+        return {};
+    }
+    while (m_records.head().state == Pending) {
+        m_cond.wait(&m_mutex);
+    }
+    const Record record = m_records.head();
+    QByteArray frame;
+    if (record.state == Stored) {
+        // 这块空间在释放之前不会被覆盖
+        locker.unlock();
+        frame = qUncompress(m_map + record.offset, record.size);
+        applyDelta(frame, m_last_take);
+        m_last_take = frame;
+        locker.relock();
+    }
+    m_records.head().released = true;
+    releaseFront();
+    return frame;
+}
+
+void FrameSpill::release(const Handle &handle) {
+    QMutexLocker locker{&m_mutex};
+    Record *record = find(handle.seq);
+    if (record != nullptr) {
+        record->released = true;
+    }
+    releaseFront();
+}
+
+qint64 FrameSpill::used() const {
+    QMutexLocker locker{&m_mutex};
+    return m_used;
+}
+
+qint64 FrameSpill::capacity() const {
+    return m_capacity;
+}
+
+void FrameSpill::run() {
+    QMutexLocker locker{&m_mutex};
+    while (true) {
+        if (m_jobs.isEmpty()) {
+            if (m_closed) break;
+            m_cond.wait(&m_mutex);
+            continue;
+        }
+        Job job = m_jobs.dequeue();
+        const qsizetype raw = job.frame.size();
+        Record *record = find(job.seq);
+        if (record == nullptr || record->released) {
+            // 已经丢弃，不压缩，也不作为之后的异或基准（之后的帧同样会被丢弃）
+            if (record != nullptr) {
+                record->state = Failed;
+                releaseFront();
+            }
+            locker.unlock();
+            ImagePool::instance()->account(ImagePool::Gif, - raw);
+            locker.relock();
+            continue;
+        }
+        locker.unlock();
+        QByteArray delta = job.frame;
+        applyDelta(delta, m_last_push);
+        const QByteArray packed = qCompress(delta, compressLevel);
+        delta = QByteArray();
+        locker.relock();
+
+        // 文件满时等读取端取走较早的帧，文件里没有其他帧仍然放不下时放弃这一帧
+        qint64 offset = reserve(packed.size());
+        while (offset < 0 && hasStored() && ! m_closed) {
+            m_cond.wait(&m_mutex);
+            offset = reserve(packed.size());
+        }
+        record = find(job.seq);
+        if (record != nullptr) {
+            if (offset >= 0) {
+                memcpy(m_map + offset, packed.constData(), packed.size());
+                record->state = Stored;
+                record->offset = offset;
+                record->size = packed.size();
+                m_used += packed.size();
+                m_last_push = std::move(job.frame);
+            } else {
+                qWarning() << "GIF溢出文件放不下这一帧" << packed.size();
+                record->state = Failed;
+            }
+            releaseFront();
+        }
+        m_cond.wakeAll();
+        locker.unlock();
+        ImagePool::instance()->account(ImagePool::Gif, - raw);
+        locker.relock();
+    }
+}
+
+FrameSpill::Record *FrameSpill::find(quint64 seq) {
+    for (auto iter = m_records.begin(); iter != m_records.end(); ++iter) {
+        if (iter->seq == seq) {
+            return &*iter;
+        }
+    }
+    return nullptr;
+}
+
+bool FrameSpill::hasStored() const {
+    for (auto iter = m_records.cbegin(); iter != m_records.cend(); ++iter) {
+        if (iter->state == Stored) return true;
+    }
+    return false;
+}
+
+qint64 FrameSpill::reserve(qint64 size) {
+    const Record *oldest = nullptr;
+    for (auto iter = m_records.cbegin(); iter != m_records.cend(); ++iter) {
+        if (iter->state == Stored) {
+            oldest = &*iter;
+            break;
+        }
+    }
+    if (oldest == nullptr) {
+        m_head = 0;
+    }
+    const qint64 tail = oldest == nullptr ? 0 : oldest->offset;
+    qint64 offset = -1;
+    if (oldest == nullptr || m_head > tail) {
+        // 空闲的是 [m_head, m_capacity) 和 [0, tail)，放不下时从头开始
+        if (m_head + size <= m_capacity) {
+            offset = m_head;
+        } else if (size <= tail) {
+            offset = 0;
+        }
+    } else if (m_head + size <= tail) {
+        // 已经绕回开头，空闲的只有 [m_head, tail)
+        offset = m_head;
+    }
+    if (offset >= 0) {
+        m_head = offset + size;
+    }
+    return offset;
+}
+
+void FrameSpill::releaseFront() {
+    // 还在等待压缩的帧由压缩线程处理完后再移除
+    while (! m_records.isEmpty() && m_records.head().released && m_records.head().state != Pending) {
+        const Record record = m_records.dequeue();
+        if (record.state == Stored) {
+            m_used -= record.size;
+        }
+        m_cond.wakeAll();
+    }
+}
+
+void FrameSpill::applyDelta(QByteArray &frame, const QByteArray &base) {
+    // 大小不同（第一帧）时保存原始数据，两端的判断相同
+    if (base.size() != frame.size()) return;
+    char *dst = frame.data();
+    const char *src = base.constData();
+    const qsizetype size = frame.size();
+    qsizetype i = 0;
+    for (; i + 8 <= size; i += 8) {
+        quint64 a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < size; ++i) {
+        dst[i] ^= src[i];
+    }
+}
@@ -0,0 +1,83 @@
+﻿#ifndef FRAMESPILL_H
+#define FRAMESPILL_H
+
+#include <QString>
+#include <QFile>
+#include <QQueue>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <thread>
+
+// GIF 帧队列超出内存上限后的溢出存储：一个预先分配并映射到内存的环形文件，
+// 每帧在后台线程与上一个溢出帧异或、用 zlib 最快的级别压缩后写入；必须按写入顺序取出
+class FrameSpill {
+public:
+    struct Handle {
+        FrameSpill *store = nullptr;
+        quint64 seq = 0;
+        bool isValid() const { return store != nullptr; }
+    };
+
+    FrameSpill();
+    ~FrameSpill();
+    Q_DISABLE_COPY_MOVE(FrameSpill)
+
+    // capacity 为磁盘配额，文件一次分配好，磁盘空间不足时返回 false
+    bool open(const QString &path, qint64 capacity);
+    bool isOpen() const;
+    // 只复制一份原始数据，压缩在后台进行；等待压缩的帧太多时返回 false
+    bool push(const uchar *data, qsizetype size, Handle *handle);
+    // 取出并释放 handle 对应的帧，handle 必须是最早的一帧，还在压缩时等待；放不进文件的帧返回空数据
+    QByteArray take(const Handle &handle);
+    // 丢弃不再需要的帧，可以不按顺序，之后的帧也不能再取出
+    void release(const Handle &handle);
+    qint64 used() const;
+    qint64 capacity() const;
+
+private:
+    enum State {
+        Pending, // 等待压缩
+        Stored,  // 已经写入文件
+        Failed   // 文件放不下
+    };
+    struct Record {
+        quint64 seq;
+        State state;
+        bool released;
+        qint64 offset;
+        qint64 size;
+    };
+    struct Job {
+        quint64 seq;
+        QByteArray frame;
+    };
+    void run();
+    // 调用时需要持有 m_mutex，找不到时返回 nullptr
+    Record *find(quint64 seq);
+    // 调用时需要持有 m_mutex，放不下时返回 -1
+    qint64 reserve(qint64 size);
+    // 调用时需要持有 m_mutex
+    bool hasStored() const;
+    void releaseFront();
+    static void applyDelta(QByteArray &frame, const QByteArray &base);
+
+    QFile m_file;
+    uchar *m_map;
+    qint64 m_capacity;
+    // 下一帧写入的位置，最早写入的一帧是 m_records 中第一个 Stored
+    qint64 m_head;
+    qint64 m_used;
+    quint64 m_next_seq;
+    QQueue<Record> m_records;
+    QQueue<Job> m_jobs;
+    bool m_closed;
+    // 压缩线程和读取端各自保存上一帧，用于异或
+    QByteArray m_last_push;
+    QByteArray m_last_take;
+    std::thread m_thread;
+    mutable QMutex m_mutex;
+    QWaitCondition m_cond;
+};
+
+#endif // FRAMESPILL_H
@@ -0,0 +1,172 @@
+﻿#include "GifEncoder.h"
+#include "ImagePool.h"
+
+#include <QDebug>
+
+// 小于这个像素数时不分块量化
+static constexpr int minBandPixels = 256 * 256;
+
+GifEncoder::GifEncoder(): m_writer{}, m_first{true}, m_ending{false}, m_closed{false}, m_submitted{0}, m_written{0} {
+}
+
+GifEncoder::~GifEncoder() {
+    end();
+}
+
+bool GifEncoder::begin(const QString &path, int width, int height, int delay) {
+    if (! GifBegin(&m_writer, path.toUtf8().constData(), width, height, delay)) {
+        qWarning() << "创建GIF文件失败" << path;
+        return false;
+    }
+    m_first = true;
+    // 录制时界面线程还要截图，留出一个核心
+    const int count = qBound(1, static_cast<int>(std::thread::hardware_concurrency()) - 1, 8);
+    for (int i = 0; i < count; ++i) {
+        m_threads.emplace_back(&GifEncoder::run, this);
+    }
+    m_write_thread = std::thread{&GifEncoder::writeBlocks, this};
+    return true;
+}
+
+bool GifEncoder::write(const uint8_t *image, int width, int height, int delay) {
+    if (m_writer.f == nullptr || m_ending) return false;
+    {
+        // 压缩跟不上时等待，正在压缩的帧数不超过线程数的两倍
+        QMutexLocker locker{&m_mutex};
+        while (m_submitted - m_written >= m_threads.size() * 2) {
+            m_cond.wait(&m_mutex);
+        }
+    }
+
+    const uint8_t *last = m_first ? nullptr : m_writer.oldImage;
+    m_first = false;
+    GifPalette palette{};
+    GifMakePalette(last, image, width, height, 8, false, &palette);
+    threshold(last, image, width, height, &palette);
+
+    // m_writer.oldImage 是下一帧的差分基准，压缩使用一份拷贝
+    const qint64 bytes = static_cast<qint64>(width) * height * 4;
+    uint8_t *indexed = new uint8_t[bytes];
+    memcpy(indexed, m_writer.oldImage, bytes);
+    ImagePool::instance()->account(ImagePool::Gif, bytes);
+
+    const quint64 seq = m_submitted;
+    {
+        QMutexLocker locker{&m_mutex};
+        ++m_submitted;
+    }
+    post([this, seq, indexed, bytes, width, height, delay, palette]() {
+        GifBlock block{nullptr, 0, 0};
+        GifEncodeLzwImage(&block, indexed, 0, 0, width, height, delay, &palette);
+        delete[] indexed;
+        ImagePool::instance()->account(ImagePool::Gif, - bytes);
+        QMutexLocker locker{&m_mutex};
+        m_blocks.insert(seq, block);
+        m_cond.wakeAll();
+    }, false);
+    return true;
+}
+
+void GifEncoder::end() {
+    if (m_writer.f == nullptr) return;
+    {
+        QMutexLocker locker{&m_mutex};
+        m_ending = true;
+        m_cond.wakeAll();
+    }
+    m_write_thread.join();
+    {
+        QMutexLocker locker{&m_job_mutex};
+        m_closed = true;
+        m_job_cond.wakeAll();
+    }
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    GifEnd(&m_writer);
+}
+
+void GifEncoder::run() {
+    QMutexLocker locker{&m_job_mutex};
+    while (true) {
+        if (! m_bands.isEmpty() || ! m_jobs.isEmpty()) {
+            std::function<void()> job = m_bands.isEmpty() ? m_jobs.dequeue() : m_bands.dequeue();
+            locker.unlock();
+            job();
+            locker.relock();
+        } else if (m_closed) {
+            break;
+        } else {
+            m_job_cond.wait(&m_job_mutex);
+        }
+    }
+}
+
+void GifEncoder::post(std::function<void()> &&job, bool band) {
+    QMutexLocker locker{&m_job_mutex};
+    (band ? m_bands : m_jobs).enqueue(std::move(job));
+    m_job_cond.wakeOne();
+}
+
+void GifEncoder::writeBlocks() {
+    QMutexLocker locker{&m_mutex};
+    while (true) {
+        auto iter = m_blocks.find(m_written);
+        if (iter != m_blocks.end()) {
+            GifBlock block = iter.value();
+            m_blocks.erase(iter);
+            locker.unlock();
+            if (! GifWriteBlock(&m_writer, &block)) {
+                qWarning() << "写入GIF帧失败";
+            }
+            GifBlockFree(&block);
+            locker.relock();
+            ++m_written;
+            m_cond.wakeAll();
+        } else if (m_ending && m_written == m_submitted) {
+            break;
+        } else {
+            m_cond.wait(&m_mutex);
+        }
+    }
+}
+
+void GifEncoder::threshold(const uint8_t *last, const uint8_t *image, int width, int height, GifPalette *palette) {
+    // 每个像素只依赖它自己和上一帧同一位置的像素，按行分块后结果不变
+    uint8_t *out = m_writer.oldImage;
+    // 调用线程也处理一块
+    const int bands = qMin(static_cast<int>(m_threads.size()) + 1, height);
+    if (bands <= 1 || width * height < minBandPixels) {
+        GifThresholdImage(last, image, out, width, height, palette);
+        return;
+    }
+    auto band = [=](int i) {
+        const int top = height * i / bands;
+        const int rows = height * (i + 1) / bands - top;
+        const size_t offset = static_cast<size_t>(top) * width * 4;
+        GifThresholdImage(last ? last + offset : nullptr, image + offset, out + offset, width, rows, palette);
+    };
+    QMutex mutex;
+    QWaitCondition done;
+    int remaining = bands - 1;
+    {
+        // 分块排在已有的压缩任务前面，一次唤醒所有工作线程
+        QMutexLocker locker{&m_job_mutex};
+        for (int i = 1; i < bands; ++i) {
+            m_bands.enqueue([&band, &mutex, &done, &remaining, i]() {
+                band(i);
+                QMutexLocker locker{&mutex};
+                if (--remaining == 0) {
+                    done.wakeAll();
+                }
+            });
+        }
+        m_job_cond.wakeAll();
+    }
+    band(0);
+    QMutexLocker locker{&mutex};
+    while (remaining > 0) {
+        done.wait(&mutex);
+    }
+}
@@ -0,0 +1,55 @@
+﻿#ifndef GIFENCODER_H
+#define GIFENCODER_H
+
+#include <QString>
+#include <QMap>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "gif.h"
+
+// 多线程 GIF 编码，输出与逐帧调用 GifWriteFrame 完全相同。
+// 调色板和差分依赖上一帧量化后的结果，只能按帧顺序在调用 write 的线程进行，其中逐像素的量化按行分块交给工作线程；
+// 各帧的 LZW 压缩互不依赖，在工作线程编码到内存，再由单独的写入线程按帧顺序追加到文件
+class GifEncoder {
+public:
+    GifEncoder();
+    ~GifEncoder();
+    Q_DISABLE_COPY_MOVE(GifEncoder)
+
+    bool begin(const QString &path, int width, int height, int delay);
+    // 只能在一个线程按帧顺序调用，image 为 RGBA8888，宽高与 begin 一致
+    bool write(const uint8_t *image, int width, int height, int delay);
+    // 等待所有帧写入文件后关闭
+    void end();
+
+private:
+    void run();
+    void post(std::function<void()> &&job, bool band);
+    void writeBlocks();
+    void threshold(const uint8_t *last, const uint8_t *image, int width, int height, GifPalette *palette);
+
+    GifWriter m_writer;
+    bool m_first;
+    bool m_ending;
+    // 量化分块阻塞着按顺序进行的调色板阶段，工作线程优先处理
+    QQueue<std::function<void()>> m_bands;
+    QQueue<std::function<void()>> m_jobs;
+    bool m_closed;
+    QMutex m_job_mutex;
+    QWaitCondition m_job_cond;
+    std::vector<std::thread> m_threads;
+    std::thread m_write_thread;
+    // 已经压缩、等待按顺序写入的帧
+    QMap<quint64, GifBlock> m_blocks;
+    quint64 m_submitted;
+    quint64 m_written;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+};
+
+#endif // GIFENCODER_H
@@ -1,5 +1,11 @@
 ﻿#include "GifWidget.h"
 #include "Tool.h"
+#include "CaptureEngine.h"
+#include "ImagePool.h"
+#include "ImageKernel.h"
+#ifdef Q_OS_LINUX
+#include "DamageMonitor.h"
+#endif // Q_OS_LINUX
 
 #include <QUuid>
 #include <QStandardPaths>
@@ -11,31 +17,59 @@
 #include <QDateTime>
 #include <QTimer>
 #include <QComboBox>
+#include <QStorageInfo>
 #include <QtMath>
-#include <malloc.h>
+
+// 变化区域过于零碎时直接截取外接矩形
+static constexpr int maxDamageRects = 16;
+// 内存中的帧超过这个大小后写入溢出文件
+static constexpr qint64 memoryHighWater = 256LL * 1024 * 1024;
+// 溢出文件的大小上限，不超过剩余磁盘空间的一半
+static constexpr qint64 spillQuota = 1024LL * 1024 * 1024;
+
+// 内存中的帧计入 ImagePool 的统计
+static inline qint64 frameBytes(const GifFrameData &data) {
+    return static_cast<qint64>(data.width) * data.height * 4;
+}
+
+static inline bool hasFrame(const GifFrameData &data) {
+    return data.image != nullptr || data.spill.isValid();
+}
+
+static void freeFrame(GifFrameData &data) {
+    if (data.image != nullptr) {
+        ImagePool::instance()->account(ImagePool::Gif, - frameBytes(data));
+        delete[] data.image;
+        data.image = nullptr;
+    } else if (data.spill.isValid()) {
+        data.spill.store->release(data.spill);
+        data.spill = {};
+    }
+}
 
 static void writeGIF(BlockQueue<GifFrameData> *queue) {
     GifFrameData data;
     while (queue->dequeue(&data)) {
-        if (data.image[0] == 'b') {
-            GifWriteFrame(data.writer, data.image + 1, data.width, data.height, data.delay);
-        } else if (data.image[0] == 'f') {
-            const char *filename = reinterpret_cast<const char*>(data.image + 1);
-            QFile file{filename};
-            if (file.open(QFile::ReadOnly)) {
-                QByteArray array = file.readAll();
-                GifWriteFrame(data.writer, reinterpret_cast<const uint8_t*>(array.constData()), data.width, data.height, data.delay);
+        if (data.image != nullptr) {
+            data.writer->write(data.image, data.width, data.height, data.delay);
+            ImagePool::instance()->account(ImagePool::Gif, - frameBytes(data));
+            delete[] data.image;
+        } else if (data.spill.isValid()) {
+            const QByteArray array = data.spill.store->take(data.spill);
+            if (array.size() == frameBytes(data)) {
+                data.writer->write(reinterpret_cast<const uint8_t*>(array.constData()), data.width, data.height, data.delay);
             }
-            QFile::remove(filename);
         }
-        delete[] data.image;
     }
 }
 
 GifWidget::GifWidget(const QSize &screenSize, const QRect &rect, QMenu *menu, qreal ratio, QWidget *parent):
-    QWidget{parent}, m_writer{nullptr}, m_timerId{-1}, m_updateTimerId{-1}, m_size{screenSize}, m_preTime{0}, m_ratio{ratio} {
+    QWidget{parent}, m_writer{nullptr}, m_timerId{-1}, m_updateTimerId{-1}, m_size{screenSize}, m_preTime{0}, m_ratio{ratio},
+    m_pending{nullptr, nullptr, {}, 0, 0, 0}, m_damage{-1}, m_spill{false}, m_store{nullptr}, m_store_failed{false}, m_hash{0}, m_duplicates{0} {
+    // 图片内存超出预算时后续的帧先写入溢出文件，直到队列清空
+    connect(ImagePool::instance(), &ImagePool::pressure, this, [this]() { m_spill = true; });
     m_tmp = QStandardPaths::writableLocation(QStandardPaths::TempLocation) + "/" + QUuid::createUuid().toString();
-    m_screen = getScreenRect(rect.adjusted(-1, -1, 1, 1));
+    m_screen = CaptureEngine::instance()->toScreenRect(rect.adjusted(-1, -1, 1, 1), m_ratio);
     setFixedSize(m_screen.size());
     setGeometry(m_screen);
     m_screen.adjust(1, 1, -1, -1);
@@ -63,6 +97,13 @@ GifWidget::~GifWidget() {
         killTimer(m_updateTimerId);
         m_updateTimerId = -1;
     }
+#ifdef Q_OS_LINUX
+    if (m_damage != -1) {
+        DamageMonitor::instance()->unsubscribe(m_damage);
+        m_damage = -1;
+    }
+#endif // Q_OS_LINUX
+    freeFrame(m_pending);
     if (m_widget != nullptr) {
         delete m_widget;
         m_widget = nullptr;
@@ -87,9 +128,12 @@ GifWidget::~GifWidget() {
         delete m_thread;
     }
     delete action;
+    delete m_store;
+    m_store = nullptr;
 
     if (m_writer != nullptr) {
-        GifEnd(m_writer);
+        // 等待工作线程压缩完剩下的帧
+        m_writer->end();
         delete m_writer;
         m_writer = nullptr;
     }
@@ -98,9 +142,7 @@ GifWidget::~GifWidget() {
         QFile::rename(m_tmp, m_path);
     }
     QFile::remove(m_tmp);
-#ifdef Q_OS_LINUX
-    malloc_trim(0);
-#endif
+    ImagePool::instance()->trim();
 }
 
 void GifWidget::paintEvent(QPaintEvent *event) {
@@ -127,7 +169,7 @@ void GifWidget::buttonClicked() {
         return;
     }
     if (m_writer == nullptr) {
-        m_writer = new GifWriter;
+        m_writer = new GifEncoder;
         float value = m_spin->value();
         if (m_box->currentIndex() == 0) {
             value = 1 / value;
@@ -145,9 +187,12 @@ void GifWidget::buttonClicked() {
         m_label->setVisible(true);
 
         m_delay = 100 / value;
-        memset(m_writer, 0, sizeof(GifWriter));
         m_startTime = QDateTime::currentMSecsSinceEpoch();
-        GifBegin(m_writer, m_tmp.toUtf8().data(), qCeil(m_screen.width() * m_ratio), qCeil(m_screen.height() * m_ratio), m_delay);
+        m_preTime = m_startTime;
+#ifdef Q_OS_LINUX
+        m_damage = DamageMonitor::instance()->subscribe(CaptureEngine::instance()->toNativeRect(m_screen, m_ratio));
+#endif // Q_OS_LINUX
+        m_writer->begin(m_tmp, qCeil(m_screen.width() * m_ratio), qCeil(m_screen.height() * m_ratio), m_delay);
         updateGIF();
     } else {
         if (m_timerId != -1) {
@@ -158,15 +203,20 @@ void GifWidget::buttonClicked() {
             killTimer(m_updateTimerId);
             m_updateTimerId = -1;
         }
+#ifdef Q_OS_LINUX
+        if (m_damage != -1) {
+            DamageMonitor::instance()->unsubscribe(m_damage);
+            m_damage = -1;
+        }
+#endif // Q_OS_LINUX
+        flushFrame();
+        qInfo() << QString("GIF录制结束，跳过%1个重复帧").arg(m_duplicates);
         m_path = QFileDialog::getSaveFileName(this, "选择路径", Tool::savePath, "*.gif");
         if (m_path.isEmpty()) {
             m_queue.close();
             GifFrameData gif;
             while (m_queue.dequeue(&gif)) {
-                if (gif.image[0] == 'f') {
-                    QFile::remove(reinterpret_cast<const char*>(gif.image + 1));
-                }
-                delete[] gif.image;
+                freeFrame(gif);
             }
         } else {
             QFileInfo fileinfo{m_path};
@@ -181,26 +231,6 @@ void GifWidget::buttonClicked() {
 
 void GifWidget::updateGIF() {
     if (m_writer) {
-        QImage &&image = screenshot();
-        uint8_t *bits = nullptr;
-        if (m_queue.size() > 100) {
-            QByteArray array = (QStandardPaths::writableLocation(QStandardPaths::TempLocation) + "/" + QUuid::createUuid().toString()).toUtf8();
-            QFile file{array};
-            if (file.open(QFile::WriteOnly | QFile::Truncate)) {
-                file.write(reinterpret_cast<const char*>(image.constBits()), image.sizeInBytes());
-                file.close();
-                bits = new uint8_t[array.size() + 2];
-                memcpy(bits + 1, array.constData(), array.size());
-                bits[0] = 'f';
-                bits[array.size() + 1] = '\0';
-            }
-        }
-        if (bits == nullptr) {
-            bits = new uint8_t[image.sizeInBytes() + 1];
-            memcpy(bits + 1, image.constBits(), image.sizeInBytes());
-            bits[0] = 'b';
-        }
-
         qint64 time = QDateTime::currentMSecsSinceEpoch();
         int delay = m_delay;
         if (time - m_preTime > delay * 10) {
@@ -208,8 +238,101 @@ void GifWidget::updateGIF() {
         }
         m_preTime = time;
 
-        m_queue.enqueue({m_writer, bits, image.width(), image.height(), delay});
+        // 区域内没有变化时延长上一帧的显示时间，GIF 的延时只有 16 位
+        if (! grabFrame() && hasFrame(m_pending) && m_pending.delay + delay <= 0xffff) {
+            m_pending.delay += delay;
+            return;
+        }
+        // 有变化通知或者不能监听变化时，像素仍可能完全相同（光标闪烁后恢复、重绘同样的内容）
+        const quint64 hash = imageHash(m_frame);
+        if (hash == m_hash && hasFrame(m_pending) && m_pending.delay + delay <= 0xffff) {
+            m_pending.delay += delay;
+            ++m_duplicates;
+            return;
+        }
+        const QImage &image = m_frame;
+        GifFrameData data{m_writer, nullptr, {}, image.width(), image.height(), delay};
+        if (m_spill && m_queue.isEmpty()) {
+            m_spill = false;
+        }
+        const bool overflow = m_spill || ImagePool::instance()->used(ImagePool::Gif) > memoryHighWater;
+        if (overflow && m_store == nullptr && ! m_store_failed) {
+            // 可用空间未知时返回 -1
+            const qint64 available = QStorageInfo{QFileInfo{m_tmp}.absolutePath()}.bytesAvailable();
+            m_store = new FrameSpill;
+            if (available <= 0 || ! m_store->open(m_tmp + ".frames", qMin(spillQuota, available / 2))) {
+                qWarning() << "GIF溢出文件不可用，超出内存上限的帧仍然保存在内存中" << available;
+                delete m_store;
+                m_store = nullptr;
+                m_store_failed = true;
+            }
+        }
+        if (overflow && m_store != nullptr) {
+            if (! m_store->push(image.constBits(), image.sizeInBytes(), &data.spill)
+                && hasFrame(m_pending) && m_pending.delay + delay <= 0xffff) {
+                // 内存已满，溢出文件也来不及压缩，丢掉这一帧，延长上一帧的显示时间
+                m_pending.delay += delay;
+                return;
+            }
+        }
+        if (! data.spill.isValid()) {
+            data.image = new uint8_t[image.sizeInBytes()];
+            memcpy(data.image, image.constBits(), image.sizeInBytes());
+            ImagePool::instance()->account(ImagePool::Gif, image.sizeInBytes());
+        }
+
+        flushFrame();
+        m_pending = data;
+        m_hash = hash;
+    }
+}
+
+bool GifWidget::grabFrame() {
+    if (m_frame.isNull()) {
+#ifdef Q_OS_LINUX
+        if (m_damage != -1) {
+            // 截图之前的变化已经包含在这一帧里
+            DamageMonitor::instance()->take(m_damage);
+        }
+#endif // Q_OS_LINUX
+        m_frame = screenshot();
+        return true;
     }
+#ifdef Q_OS_LINUX
+    if (m_damage != -1) {
+        QRegion region = DamageMonitor::instance()->take(m_damage);
+        if (region.isEmpty()) return false;
+        if (region.rectCount() > maxDamageRects) {
+            region = region.boundingRect();
+        }
+
+        CaptureEngine *engine = CaptureEngine::instance();
+        const QPoint origin = engine->toNativeRect(m_screen, m_ratio).topLeft();
+        const int bpp = m_frame.depth() / 8;
+        for (auto iter = region.begin(); iter != region.end(); ++iter) {
+            const QRect rect = iter->intersected(m_frame.rect());
+            if (rect.isEmpty()) continue;
+            QImage part = engine->grabRegion(rect.translated(origin), m_frame.format());
+            const int width = qMin(part.width(), rect.width());
+            const int height = qMin(part.height(), rect.height());
+            for (int y = 0; y < height; ++y) {
+                memcpy(m_frame.scanLine(rect.y() + y) + rect.x() * bpp, part.constScanLine(y), static_cast<size_t>(width) * bpp);
+            }
+        }
+        return true;
+    }
+#endif // Q_OS_LINUX
+    m_frame = screenshot();
+    return true;
+}
+
+void GifWidget::flushFrame() {
+    if (! hasFrame(m_pending)) return;
+    if (! m_queue.enqueue(m_pending)) {
+        freeFrame(m_pending);
+    }
+    m_pending.image = nullptr;
+    m_pending.spill = {};
 }
 
 void GifWidget::init() {
@@ -277,62 +400,6 @@ void GifWidget::init() {
 }
 
 QImage GifWidget::screenshot() {
-    QList<QScreen*> list = QApplication::screens();
-    QSize size;
-    QRect rect = m_screen;
-    rect.setWidth(rect.width() * m_ratio);
-    rect.setHeight(rect.height() * m_ratio);
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect tmp = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        tmp.setWidth(tmp.width() * ratio);
-        tmp.setHeight(tmp.height() * ratio);
-        size.setWidth(qMax<int>(tmp.right() + 1, size.width()));
-        size.setHeight(qMax<int>(tmp.bottom() + 1, size.height()));
-        if (tmp.contains(rect)) {
-            return (*iter)->grabWindow(0)
-            .copy((rect.left() - tmp.left()) * m_ratio,
-                  (rect.top() - tmp.top()) * m_ratio,
-                  rect.width(),
-                  rect.height())
-                .toImage()
-                .convertToFormat(QImage::Format_RGBA8888);
-        }
-    }
-
-    QImage image(size, QImage::Format_RGBA8888);
-    QPainter painter(&image);
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QScreen *screen = (*iter);
-        painter.drawPixmap(screen->geometry(), screen->grabWindow(0));
-    }
-    painter.end();
-    return image.copy(rect);
-}
-
-QRect GifWidget::getScreenRect(const QRect &rect) {
-    if (m_ratio == 1) return rect;
-
-    QPoint pos = rect.topLeft() * m_ratio;
-    QList<QScreen*> list = QApplication::screens();
-    QScreen* targetScreen = nullptr;
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect tmp = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        tmp.setWidth(tmp.width() * ratio);
-        tmp.setHeight(tmp.height() * ratio);
-        if (tmp.contains(pos)) {
-            targetScreen = *iter;
-            break;
-        }
-    }
-    if (! targetScreen) {
-        targetScreen = QApplication::primaryScreen();
-    }
-
-    QRect targetRect = targetScreen->geometry();
-    int x = (pos.x() - targetRect.left()) / m_ratio + targetRect.left();
-    int y = (pos.y() - targetRect.top()) / m_ratio + targetRect.top();
-
-    return {x, y, rect.width(), rect.height()};
+    CaptureEngine *engine = CaptureEngine::instance();
+    return engine->grabRegion(engine->toNativeRect(m_screen, m_ratio), QImage::Format_RGBA8888);
 }
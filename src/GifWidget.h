@@ -12,13 +12,16 @@
 #include <QQueue>
 #include <thread>
 
-#include "gif.h"
+#include "GifEncoder.h"
+#include "FrameSpill.h"
 #include "BlockQueue.h"
 
 class QComboBox;
 struct GifFrameData {
-    GifWriter* writer;
+    GifEncoder* writer;
+    // 帧在内存中时 image 有效，溢出到磁盘时 spill 有效
     uint8_t* image;
+    FrameSpill::Handle spill;
     int width;
     int height;
     int delay;
@@ -39,12 +42,13 @@ private:
     void updateGIF();
     void init();
     QImage screenshot();
+    bool grabFrame();
+    void flushFrame();
     void start();
-    QRect getScreenRect(const QRect &rect);
 
     QString m_tmp;
     QString m_path;
-    GifWriter *m_writer;
+    GifEncoder *m_writer;
     int m_timerId;
     int m_updateTimerId;
     int m_delay;
@@ -67,6 +71,17 @@ private:
 
     std::thread *m_thread;
     BlockQueue<GifFrameData> m_queue;
+    // 最后一帧先不入队，之后画面没有变化时只增加它的延时
+    GifFrameData m_pending;
+    QImage m_frame;
+    int m_damage;
+    bool m_spill;
+    // 第一次需要溢出时创建，创建失败后不再尝试，帧继续留在内存中
+    FrameSpill *m_store;
+    bool m_store_failed;
+    // 上一个入队帧的哈希，相同的帧只增加上一帧的延时
+    quint64 m_hash;
+    int m_duplicates;
 };
 
 #endif // GIFWIDGET_H
@@ -0,0 +1,250 @@
+﻿#include "ImageKernel.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// x86_64 一定支持 SSE2，AVX2 运行时检测
+#if defined(__x86_64__) || defined(_M_X64)
+#define KERNEL_X86
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+// 每个线程至少处理的像素数，太小时线程切换的开销比计算还大
+static constexpr qsizetype minPixelsPerThread = 256 * 1024;
+
+// x * 205 >> 9 与 0 到 255 范围内 0.4 * x 的整数部分完全相同
+static inline quint32 dimPixel(quint32 pixel) {
+    quint32 r = ((pixel >> 16 & 0xff) * 205) >> 9;
+    quint32 g = ((pixel >> 8 & 0xff) * 205) >> 9;
+    quint32 b = ((pixel & 0xff) * 205) >> 9;
+    return 0xff000000 | r << 16 | g << 8 | b;
+}
+
+static void dimRowScalar(const quint32 *src, quint32 *dst, int width) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = dimPixel(src[x]);
+    }
+}
+
+#ifdef KERNEL_X86
+static void dimRowSse2(const quint32 *src, quint32 *dst, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i factor = _mm_set1_epi16(205);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), factor), 9);
+        __m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), factor), 9);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(_mm_packus_epi16(low, high), alpha));
+    }
+    dimRowScalar(src + x, dst + x, width - x);
+}
+#endif // KERNEL_X86
+
+#ifdef KERNEL_AVX2
+__attribute__((target("avx2")))
+static void dimRowAvx2(const quint32 *src, quint32 *dst, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i factor = _mm256_set1_epi16(205);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        // unpack 和 pack 都在 128 位通道内进行，像素顺序不变
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+        __m256i low = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), factor), 9);
+        __m256i high = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), factor), 9);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_or_si256(_mm256_packus_epi16(low, high), alpha));
+    }
+    dimRowSse2(src + x, dst + x, width - x);
+}
+#endif // KERNEL_AVX2
+
+using DimRow = void (*)(const quint32*, quint32*, int);
+
+struct DimKernel {
+    const char *name;
+    DimRow row;
+};
+
+// 当前 CPU 支持的实现，从快到慢排列，dimImage 使用第一个
+static QVector<DimKernel> supportedKernels() {
+    QVector<DimKernel> list;
+#ifdef KERNEL_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        list.push_back({"avx2", dimRowAvx2});
+    }
+#endif // KERNEL_AVX2
+#ifdef KERNEL_X86
+    list.push_back({"sse2", dimRowSse2});
+#endif // KERNEL_X86
+    list.push_back({"scalar", dimRowScalar});
+    return list;
+}
+
+static const QVector<DimKernel> kernels = supportedKernels();
+
+const char* dimKernelName() {
+    return kernels.first().name;
+}
+
+QVector<const char*> dimKernelNames() {
+    QVector<const char*> names;
+    for (auto iter = kernels.cbegin(); iter != kernels.cend(); ++iter) {
+        names.push_back(iter->name);
+    }
+    return names;
+}
+
+// 处理一段行，结束后释放一次 done；由调用方持有，线程池不负责删除
+class DimTask : public QRunnable {
+public:
+    DimTask(std::function<void()> &&work, QSemaphore *done): m_work{std::move(work)}, m_done{done} {
+        setAutoDelete(false);
+    }
+    void run() override {
+        m_work();
+        m_done->release();
+    }
+
+private:
+    std::function<void()> m_work;
+    QSemaphore *m_done;
+};
+
+static void dimRows(DimRow kernel, const QImage &src, QImage &dst) {
+    if (src.isNull() || dst.size() != src.size() || dst.depth() != 32) return;
+    QImage source = src;
+    if (source.depth() != 32 || source.format() == QImage::Format_RGBA8888 ||
+        source.format() == QImage::Format_RGBX8888 || source.format() == QImage::Format_RGBA8888_Premultiplied) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+    }
+
+    const int width = source.width();
+    const int height = source.height();
+    const uchar *sbits = source.constBits();
+    uchar *dbits = dst.bits();
+    const qsizetype sstride = source.bytesPerLine();
+    const qsizetype dstride = dst.bytesPerLine();
+    auto run = [=](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            kernel(reinterpret_cast<const quint32*>(sbits + y * sstride), reinterpret_cast<quint32*>(dbits + y * dstride), width);
+        }
+    };
+
+    // 使用常驻的全局线程池，不在截图路径上创建线程
+    QThreadPool *pool = QThreadPool::globalInstance();
+    qsizetype pixels = static_cast<qsizetype>(width) * height;
+    int count = static_cast<int>(qBound<qsizetype>(1, pixels / minPixelsPerThread, qMax(1, pool->maxThreadCount())));
+    count = qMin(count, height);
+    const int step = (height + count - 1) / count;
+    QSemaphore done;
+    std::vector<std::unique_ptr<DimTask>> tasks;
+    tasks.reserve(count - 1);
+    for (int i = 1; i < count; ++i) {
+        const int begin = qMin(i * step, height);
+        const int end = qMin((i + 1) * step, height);
+        tasks.emplace_back(new DimTask{[=]() { run(begin, end); }, &done});
+        pool->start(tasks.back().get());
+    }
+    run(0, qMin(step, height));
+    // 线程池忙时不等待，自己处理还没开始的部分
+    for (auto &task : tasks) {
+        if (pool->tryTake(task.get())) {
+            task->run();
+        }
+    }
+    done.acquire(static_cast<int>(tasks.size()));
+}
+
+void dimImage(const QImage &src, QImage &dst) {
+    dimRows(kernels.first().row, src, dst);
+}
+
+bool dimImage(const QImage &src, QImage &dst, const char *kernel) {
+    for (auto iter = kernels.cbegin(); iter != kernels.cend(); ++iter) {
+        if (strcmp(iter->name, kernel) == 0) {
+            dimRows(iter->row, src, dst);
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline quint64 hashMix(quint64 hash, quint64 value) {
+    hash ^= value * 0x9e3779b97f4a7c15ull;
+    hash = (hash << 31 | hash >> 33) * 0xff51afd7ed558ccdull;
+    return hash;
+}
+
+quint64 hashBytes(const void *data, qsizetype size, quint64 seed) {
+    const uchar *bytes = static_cast<const uchar*>(data);
+    quint64 hash = seed ^ static_cast<quint64>(size);
+    qsizetype i = 0;
+    if (size >= 32) {
+        // 四路互不依赖的乘法链，不用等上一次乘法的结果，整行哈希快一半左右
+        quint64 lanes[4] = {hash, hash ^ 0x9e3779b97f4a7c15ull, hash ^ 0xc2b2ae3d27d4eb4full, hash ^ 0x165667b19e3779f9ull};
+        for (; i + 32 <= size; i += 32) {
+            for (int k = 0; k < 4; ++k) {
+                quint64 value;
+                memcpy(&value, bytes + i + k * 8, 8);
+                lanes[k] = hashMix(lanes[k], value);
+            }
+        }
+        for (int k = 0; k < 4; ++k) {
+            hash = hashMix(hash, lanes[k]);
+        }
+    }
+    for (; i + 8 <= size; i += 8) {
+        quint64 value;
+        memcpy(&value, bytes + i, 8);
+        hash = hashMix(hash, value);
+    }
+    if (i < size) {
+        quint64 value = 0;
+        memcpy(&value, bytes + i, size - i);
+        hash = hashMix(hash, value);
+    }
+    return hash ^ (hash >> 29);
+}
+
+quint64 imageHash(const QImage &image) {
+    if (image.isNull()) return 0;
+    const qsizetype bytes = (static_cast<qsizetype>(image.width()) * image.depth() + 7) / 8;
+    quint64 hash = static_cast<quint64>(image.width()) << 32 | static_cast<quint32>(image.height());
+    for (int y = 0; y < image.height(); ++y) {
+        hash = hashBytes(image.constScanLine(y), bytes, hash);
+    }
+    return hash;
+}
+
+void tileHashes(const QImage &image, int tile, QVector<quint64> &hashes) {
+    if (image.isNull() || image.depth() != 32 || tile <= 0) {
+        hashes.clear();
+        return;
+    }
+    const int width = image.width();
+    const int height = image.height();
+    const int columns = (width + tile - 1) / tile;
+    const int rows = (height + tile - 1) / tile;
+    hashes.fill(0, columns * rows);
+    // 逐行把每块对应的一段接到该块的哈希上，按内存顺序读取
+    for (int y = 0; y < height; ++y) {
+        const uchar *line = image.constScanLine(y);
+        quint64 *row = hashes.data() + (y / tile) * columns;
+        for (int x = 0; x < columns; ++x) {
+            const int w = qMin(tile, width - x * tile);
+            row[x] = hashBytes(line + x * tile * 4, w * 4, row[x]);
+        }
+    }
+}
@@ -0,0 +1,24 @@
+﻿#ifndef IMAGEKERNEL_H
+#define IMAGEKERNEL_H
+
+#include <QImage>
+#include <QVector>
+
+// 截图遮罩：RGB 分量乘以 0.4 后向下取整，结果不透明
+// dst 必须与 src 大小相同且为 32 位格式，按行拆分到多个线程处理
+void dimImage(const QImage &src, QImage &dst);
+// 使用指定的指令集，供 bench/dim_bench 比较，当前 CPU 不支持时返回 false
+bool dimImage(const QImage &src, QImage &dst, const char *kernel);
+// 当前使用的指令集
+const char* dimKernelName();
+// 当前 CPU 支持的所有指令集，第一个为 dimImage 默认使用的
+QVector<const char*> dimKernelNames();
+
+// 64 位非加密哈希，每次把 32 字节分给四路各 8 字节独立计算，剩余部分逐 8 字节处理，用于判断图片内容是否变化
+quint64 hashBytes(const void *data, qsizetype size, quint64 seed = 0);
+// 整张图片的哈希，不包括每行末尾的填充字节
+quint64 imageHash(const QImage &image);
+// 把 32 位图片按 tile x tile 划分，按行优先把每块的哈希写入 hashes
+void tileHashes(const QImage &image, int tile, QVector<quint64> &hashes);
+
+#endif // IMAGEKERNEL_H
@@ -0,0 +1,202 @@
+﻿#include "ImagePool.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QDebug>
+#include <QStringList>
+#ifdef Q_OS_LINUX
+#include <malloc.h>
+#endif // Q_OS_LINUX
+
+static constexpr qint64 defaultBudget = 1024LL * 1024 * 1024;
+// 空闲缓冲区最多占预算的四分之一
+static constexpr int cacheDivisor = 4;
+static std::atomic_bool poolAlive{false};
+
+ImagePool::ImagePool(QObject *parent): QObject{parent}, m_cached{0}, m_budget{defaultBudget}, m_notify{false} {
+    for (int i = 0; i < OwnerCount; ++i) {
+        m_used[i] = 0;
+    }
+    // 可能在后台线程第一次使用，pressure 信号需要在主线程发出
+    if (QCoreApplication::instance()) {
+        moveToThread(QCoreApplication::instance()->thread());
+    }
+    poolAlive = true;
+}
+
+ImagePool::~ImagePool() {
+    poolAlive = false;
+    QMutexLocker locker{&m_mutex};
+    evict(0);
+}
+
+ImagePool* ImagePool::instance() {
+    static ImagePool self;
+    return &self;
+}
+
+// 按 2 的幂划分区间，每个区间再分 8 级，同一级的缓冲区可以互相复用，最多浪费 12.5%
+size_t ImagePool::sizeClass(size_t bytes) {
+    size_t step = 4096;
+    while ((step << 3) < bytes) {
+        step <<= 1;
+    }
+    return (bytes + step - 1) / step * step;
+}
+
+QImage ImagePool::acquire(const QSize &size, QImage::Format format, Owner owner) {
+    if (size.isEmpty()) return {};
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    const qsizetype bytesPerLine = ((static_cast<qsizetype>(size.width()) * depth + 31) >> 5) << 2;
+    const size_t bytes = sizeClass(static_cast<size_t>(bytesPerLine) * size.height());
+
+    Buffer *buffer = nullptr;
+    QMutexLocker locker{&m_mutex};
+    auto iter = m_free.find(bytes);
+    if (iter != m_free.end() && ! iter->isEmpty()) {
+        buffer = iter->takeLast();
+        if (iter->isEmpty()) {
+            m_free.erase(iter);
+        }
+        m_cached -= buffer->bytes;
+    }
+    locker.unlock();
+
+    if (buffer == nullptr) {
+        uchar *data = static_cast<uchar*>(qMallocAligned(bytes, 64));
+        if (data == nullptr) {
+            qWarning() << "申请图片内存失败" << size;
+            return {};
+        }
+        buffer = new Buffer{data, bytes, owner};
+    }
+    buffer->owner = owner;
+    m_used[owner] += buffer->bytes;
+    check();
+    return QImage(buffer->data, size.width(), size.height(), bytesPerLine, format, &ImagePool::releaseBuffer, buffer);
+}
+
+void ImagePool::account(Owner owner, qint64 bytes) {
+    m_used[owner] += bytes;
+    if (bytes > 0) {
+        check();
+    }
+}
+
+void ImagePool::releaseBuffer(void *info) {
+    Buffer *buffer = static_cast<Buffer*>(info);
+    if (poolAlive) {
+        ImagePool::instance()->release(buffer);
+        return;
+    }
+    qFreeAligned(buffer->data);
+    delete buffer;
+}
+
+void ImagePool::release(Buffer *buffer) {
+    m_used[buffer->owner] -= buffer->bytes;
+    qint64 used = 0;
+    for (int i = 0; i < OwnerCount; ++i) {
+        used += m_used[i];
+    }
+    QMutexLocker locker{&m_mutex};
+    if (m_cached + static_cast<qint64>(buffer->bytes) <= m_budget / cacheDivisor &&
+        used + m_cached + static_cast<qint64>(buffer->bytes) <= m_budget) {
+        m_free[buffer->bytes].push_back(buffer);
+        m_cached += buffer->bytes;
+        return;
+    }
+    locker.unlock();
+    qFreeAligned(buffer->data);
+    delete buffer;
+}
+
+void ImagePool::evict(qint64 limit) {
+    // 先释放最大的缓冲区
+    while (m_cached > limit && ! m_free.isEmpty()) {
+        auto iter = m_free.end();
+        --iter;
+        Buffer *buffer = iter->takeLast();
+        if (iter->isEmpty()) {
+            m_free.erase(iter);
+        }
+        m_cached -= buffer->bytes;
+        qFreeAligned(buffer->data);
+        delete buffer;
+    }
+}
+
+void ImagePool::check() {
+    qint64 used = 0;
+    for (int i = 0; i < OwnerCount; ++i) {
+        used += m_used[i];
+    }
+    QMutexLocker locker{&m_mutex};
+    if (used + m_cached <= m_budget) return;
+    evict(qMax<qint64>(0, m_budget - used));
+    locker.unlock();
+    // 同一轮事件循环内只通知一次
+    if (used > m_budget && ! m_notify.exchange(true)) {
+        QMetaObject::invokeMethod(this, "notifyPressure", Qt::QueuedConnection);
+    }
+}
+
+void ImagePool::notifyPressure() {
+    m_notify = false;
+    qint64 used = 0;
+    for (int i = 0; i < OwnerCount; ++i) {
+        used += m_used[i];
+    }
+    const qint64 excess = used - budget();
+    if (excess <= 0) return;
+    qWarning().noquote() << "图片内存超出预算" << excess / 1024 << "KB," << statsString();
+    emit pressure(excess);
+    trim();
+}
+
+void ImagePool::setBudget(qint64 bytes) {
+    QMutexLocker locker{&m_mutex};
+    m_budget = qMax<qint64>(bytes, 64LL * 1024 * 1024);
+    locker.unlock();
+    check();
+}
+
+qint64 ImagePool::budget() const {
+    QMutexLocker locker{&m_mutex};
+    return m_budget;
+}
+
+qint64 ImagePool::used(Owner owner) const {
+    return m_used[owner];
+}
+
+qint64 ImagePool::cached() const {
+    QMutexLocker locker{&m_mutex};
+    return m_cached;
+}
+
+void ImagePool::trim() {
+    QMutexLocker locker{&m_mutex};
+    evict(0);
+    locker.unlock();
+#ifdef Q_OS_LINUX
+    malloc_trim(0);
+#endif // Q_OS_LINUX
+}
+
+QString ImagePool::statsString() const {
+    static const char *names[OwnerCount] = {"截图", "遮罩", "置顶", "长截图", "GIF", "历史"};
+    QStringList list;
+    qint64 total = 0;
+    for (int i = 0; i < OwnerCount; ++i) {
+        const qint64 bytes = m_used[i];
+        total += bytes;
+        list << QString("%1 %2MB").arg(names[i]).arg(bytes / 1048576.0, 0, 'f', 1);
+    }
+    const qint64 free = cached();
+    list << QString("空闲 %1MB").arg(free / 1048576.0, 0, 'f', 1);
+    return QString("%1 / %2MB (%3)")
+        .arg((total + free) / 1048576.0, 0, 'f', 1)
+        .arg(budget() / 1048576.0, 0, 'f', 0)
+        .arg(list.join(", "));
+}
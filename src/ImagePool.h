@@ -0,0 +1,73 @@
+﻿#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include <QObject>
+#include <QImage>
+#include <QMap>
+#include <QVector>
+#include <QMutex>
+#include <atomic>
+
+// 全局的图片缓冲区回收池：按大小分级复用内存，统计各模块持有的字节数，
+// 超出预算时先释放空闲的缓冲区，仍然超出时发出 pressure 信号让各模块自行收缩
+class ImagePool : public QObject {
+    Q_OBJECT
+    explicit ImagePool(QObject *parent = nullptr);
+    Q_DISABLE_COPY_MOVE(ImagePool)
+
+public:
+    enum Owner {
+        Capture = 0, // 截图结果
+        Overlay,     // 截图界面的遮罩
+        Pin,         // 置顶窗口
+        LongShot,    // 长截图
+        Gif,         // GIF 帧队列
+        History,     // 截图历史
+        OwnerCount
+    };
+
+    ~ImagePool();
+    static ImagePool* instance();
+
+    // 图片释放后缓冲区自动归还
+    QImage acquire(const QSize &size, QImage::Format format, Owner owner);
+    // 不经过回收池分配的内存也计入统计和预算，释放时传入负数
+    void account(Owner owner, qint64 bytes);
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+    qint64 used(Owner owner) const;
+    qint64 cached() const;
+    // 释放所有空闲缓冲区，并把空闲内存还给系统
+    void trim();
+    QString statsString() const;
+
+signals:
+    // excess 为超出预算的字节数，在主线程发出
+    void pressure(qint64 excess);
+
+private slots:
+    void notifyPressure();
+
+private:
+    struct Buffer {
+        uchar *data;
+        size_t bytes;
+        Owner owner;
+    };
+    static void releaseBuffer(void *info);
+    static size_t sizeClass(size_t bytes);
+    void release(Buffer *buffer);
+    // 调用时需要持有 m_mutex
+    void evict(qint64 limit);
+    void check();
+
+    QMap<size_t, QVector<Buffer*>> m_free;
+    qint64 m_cached;
+    qint64 m_budget;
+    std::atomic<qint64> m_used[OwnerCount];
+    std::atomic_bool m_notify;
+    mutable QMutex m_mutex;
+};
+
+#endif // IMAGEPOOL_H
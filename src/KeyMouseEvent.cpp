@@ -148,7 +148,8 @@ void KeyMouseEvent::handleEvent(XRecordInterceptData *data) {
                 break;
             }
             break;
-        case KeyPress:
+        case KeyPress: {
+            Qt::KeyboardModifiers old = m_modifiers;
             if (event->u.u.detail == 37 || event->u.u.detail == 105) {
                 m_modifiers |= Qt::ControlModifier;
             }
@@ -158,9 +159,14 @@ void KeyMouseEvent::handleEvent(XRecordInterceptData *data) {
             if (event->u.u.detail == 50 || event->u.u.detail == 62) {
                 m_modifiers |= Qt::ShiftModifier;
             }
+            if (old != m_modifiers) {
+                emit modifiersChanged(m_modifiers);
+            }
             emit keyPress(event->u.u.detail, m_modifiers);
             break;
-        case KeyRelease:
+        }
+        case KeyRelease: {
+            Qt::KeyboardModifiers old = m_modifiers;
             if (event->u.u.detail == 37 || event->u.u.detail == 105) {
                 m_modifiers &= ~Qt::ControlModifier;
             }
@@ -170,8 +176,12 @@ void KeyMouseEvent::handleEvent(XRecordInterceptData *data) {
             if (event->u.u.detail == 50 || event->u.u.detail == 62) {
                 m_modifiers &= ~Qt::ShiftModifier;
             }
+            if (old != m_modifiers) {
+                emit modifiersChanged(m_modifiers);
+            }
             emit keyRelease(event->u.u.detail, m_modifiers);
             break;
+        }
         default:
             break;
         }
@@ -39,6 +39,7 @@ signals:
 
     void keyPress(int code, Qt::KeyboardModifiers modifiers);
     void keyRelease(int code, Qt::KeyboardModifiers modifiers);
+    void modifiersChanged(Qt::KeyboardModifiers modifiers);
 private:
     bool running;
     Qt::KeyboardModifiers m_modifiers;
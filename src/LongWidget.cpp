@@ -10,6 +10,8 @@
 #include "LongWidget.h"
 #include "TopWidget.h"
 #include "mainwindow.h"
+#include "CaptureEngine.h"
+#include "ImagePool.h"
 
 // 向下匹配（bigImage底部 和 新图顶部）
 static int downMerge(const cv::Mat &grayBig, const cv::Mat &grayNew) {
@@ -71,7 +73,7 @@ static void mergePicture(LongWidget *w, QImage *bigImage, QReadWriteLock *lock,
         if (data.down) {
             int downOverlap = downMerge(grayBig, grayNew);
             if (downOverlap < grayNew.rows) {
-                resultImg = QImage(QSize(grayBig.cols, grayBig.rows + grayNew.rows - downOverlap), QImage::Format_BGR888);
+                resultImg = ImagePool::instance()->acquire(QSize(grayBig.cols, grayBig.rows + grayNew.rows - downOverlap), QImage::Format_BGR888, ImagePool::LongShot);
                 QPainter painter(&resultImg);
                 lock->lockForRead();
                 painter.drawImage(QRect{0, 0, grayBig.cols, grayBig.rows - downOverlap}, *bigImage, QRect{0, 0, grayBig.cols, grayBig.rows - downOverlap});
@@ -89,7 +91,7 @@ static void mergePicture(LongWidget *w, QImage *bigImage, QReadWriteLock *lock,
         } else {
             int upOverlap = upMerge(grayBig, grayNew);
             if (upOverlap < grayNew.rows) {
-                resultImg = QImage(QSize(grayBig.cols, grayBig.rows + grayNew.rows - upOverlap), QImage::Format_BGR888);
+                resultImg = ImagePool::instance()->acquire(QSize(grayBig.cols, grayBig.rows + grayNew.rows - upOverlap), QImage::Format_BGR888, ImagePool::LongShot);
                 QPainter painter(&resultImg);
                 painter.drawImage(image.rect(), image);
                 lock->lockForRead();
@@ -118,9 +120,13 @@ static void mergePicture(LongWidget *w, QImage *bigImage, QReadWriteLock *lock,
 
 LongWidget::LongWidget(const QImage &image, const QRect &rect, const QSize &size, QMenu *menu, qreal ratio):
     m_widget{nullptr}, m_size{size}, m_tray_menu{menu}, m_ratio{ratio} {
-    m_image = image.convertToFormat(QImage::Format_BGR888);
+    m_image = ImagePool::instance()->acquire(image.size(), QImage::Format_BGR888, ImagePool::LongShot);
+    QPainter painter(&m_image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, image);
+    painter.end();
 
-    m_screen = getScreenRect(rect.adjusted(-1, -1, 1, 1));
+    m_screen = CaptureEngine::instance()->toScreenRect(rect.adjusted(-1, -1, 1, 1), m_ratio);
     setFixedSize(m_screen.size());
     setGeometry(m_screen);
     m_screen.adjust(1, 1, -1, -1);
@@ -215,13 +221,7 @@ void LongWidget::save() {
 
 void LongWidget::updateLabel() {
     if (m_label) {
-        QList<QScreen*> list = QApplication::screens();
-        QSize size;
-        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-            QRect rect = (*iter)->geometry();
-            size.setWidth(qMax(rect.right() + 1, size.width()));
-            size.setHeight(qMax(rect.bottom() + 1, size.height()));
-        }
+        QSize size = CaptureEngine::instance()->logicalSize();
 
         QPoint point;
         QRect geometry = this->geometry();
@@ -345,62 +345,6 @@ void LongWidget::stop() {
 }
 
 QImage LongWidget::screenshot() {
-    QList<QScreen*> list = QApplication::screens();
-    QSize size;
-    QRect rect = m_screen;
-    rect.setWidth(rect.width() * m_ratio);
-    rect.setHeight(rect.height() * m_ratio);
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect tmp = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        tmp.setWidth(tmp.width() * ratio);
-        tmp.setHeight(tmp.height() * ratio);
-        size.setWidth(qMax<int>(tmp.right() + 1, size.width()));
-        size.setHeight(qMax<int>(tmp.bottom() + 1, size.height()));
-        if (tmp.contains(rect)) {
-            return (*iter)->grabWindow(0)
-                .copy((rect.left() - tmp.left()) * m_ratio,
-                      (rect.top() - tmp.top()) * m_ratio,
-                      rect.width(),
-                      rect.height())
-                .toImage()
-                .convertToFormat(QImage::Format_BGR888);
-        }
-    }
-
-    QImage image(size, QImage::Format_BGR888);
-    QPainter painter(&image);
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QScreen *screen = (*iter);
-        painter.drawPixmap(screen->geometry(), screen->grabWindow(0));
-    }
-    painter.end();
-    return image.copy(rect);
-}
-
-QRect LongWidget::getScreenRect(const QRect &rect) {
-    if (m_ratio == 1) return rect;
-
-    QPoint pos = rect.topLeft() * m_ratio;
-    QList<QScreen*> list = QApplication::screens();
-    QScreen* targetScreen = nullptr;
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect tmp = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        tmp.setWidth(tmp.width() * ratio);
-        tmp.setHeight(tmp.height() * ratio);
-        if (tmp.contains(pos)) {
-            targetScreen = *iter;
-            break;
-        }
-    }
-    if (! targetScreen) {
-        targetScreen = QApplication::primaryScreen();
-    }
-
-    QRect targetRect = targetScreen->geometry();
-    int x = (pos.x() - targetRect.left()) / m_ratio + targetRect.left();
-    int y = (pos.y() - targetRect.top()) / m_ratio + targetRect.top();
-
-    return {x, y, rect.width(), rect.height()};
+    CaptureEngine *engine = CaptureEngine::instance();
+    return engine->grabRegion(engine->toNativeRect(m_screen, m_ratio), QImage::Format_BGR888);
 }
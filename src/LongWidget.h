@@ -39,7 +39,6 @@ private:
     void join();
     void stop();
     QImage screenshot();
-    QRect getScreenRect(const QRect &rect);
 
     QImage m_image;
     QWidget *m_widget;
@@ -0,0 +1,110 @@
+﻿#include "RegionWatcher.h"
+#include "CaptureEngine.h"
+#include "ImageKernel.h"
+
+#include <QElapsedTimer>
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include "DamageMonitor.h"
+#endif // Q_OS_LINUX
+
+// 分块边长，32x32 的分块足够发现一行文字的变化
+static constexpr int tileSize = 32;
+// 最多每秒检查 5 次
+static constexpr int minInterval = 200;
+static constexpr int maxInterval = 60000;
+
+RegionWatcher::RegionWatcher(QObject *parent): QObject{parent}, m_threshold{5}, m_budget{2}, m_cost{0} {
+#ifdef Q_OS_LINUX
+    m_damage = -1;
+#endif // Q_OS_LINUX
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &RegionWatcher::check);
+}
+
+RegionWatcher::~RegionWatcher() {
+    stop();
+}
+
+void RegionWatcher::start(const QRect &rect) {
+    stop();
+    if (rect.isEmpty()) return;
+    m_rect = rect;
+    m_cost = 0;
+#ifdef Q_OS_LINUX
+    m_damage = DamageMonitor::instance()->subscribe(m_rect);
+#endif // Q_OS_LINUX
+    // 基准在第一次检查时截取，这时截图界面已经关闭
+    m_baseline.clear();
+    qInfo().noquote() << QString("开始监视区域:(%1,%2 %3x%4) 阈值%5% CPU上限%6%")
+                             .arg(m_rect.x()).arg(m_rect.y()).arg(m_rect.width()).arg(m_rect.height()).arg(m_threshold).arg(m_budget);
+    m_timer.start(minInterval);
+}
+
+void RegionWatcher::stop() {
+    if (m_rect.isEmpty()) return;
+    m_timer.stop();
+#ifdef Q_OS_LINUX
+    if (m_damage != -1) {
+        DamageMonitor::instance()->unsubscribe(m_damage);
+        m_damage = -1;
+    }
+#endif // Q_OS_LINUX
+    qInfo() << "停止监视区域";
+    m_rect = QRect{};
+    m_baseline.clear();
+    m_hashes.clear();
+}
+
+bool RegionWatcher::isActive() const {
+    return ! m_rect.isEmpty();
+}
+
+QRect RegionWatcher::rect() const {
+    return m_rect;
+}
+
+void RegionWatcher::setThreshold(int percent) {
+    m_threshold = qBound(1, percent, 100);
+}
+
+void RegionWatcher::setBudget(int percent) {
+    m_budget = qBound(1, percent, 100);
+}
+
+void RegionWatcher::check() {
+    if (m_rect.isEmpty()) return;
+#ifdef Q_OS_LINUX
+    // 区域内没有任何重绘，不需要截图
+    if (m_damage != -1 && ! m_baseline.isEmpty() && DamageMonitor::instance()->take(m_damage).isEmpty()) {
+        m_timer.start();
+        return;
+    }
+#endif // Q_OS_LINUX
+
+    QElapsedTimer timer;
+    timer.start();
+    QImage image = CaptureEngine::instance()->grabRegion(m_rect, QImage::Format_RGB32);
+    tileHashes(image, tileSize, m_hashes);
+    int count = 0;
+    if (m_baseline.isEmpty()) {
+        m_baseline.swap(m_hashes);
+    } else if (m_hashes.size() == m_baseline.size()) {
+        for (int i = 0; i < m_hashes.size(); ++i) {
+            if (m_hashes[i] != m_baseline[i]) ++count;
+        }
+    } else {
+        count = m_hashes.size();
+    }
+    // 与上次触发时比较，缓慢累积的变化也能触发
+    if (! m_hashes.isEmpty() && count * 100 >= m_threshold * m_hashes.size()) {
+        m_baseline.swap(m_hashes);
+        emit changed(image);
+    }
+    const qint64 cost = timer.nsecsElapsed();
+    m_cost = m_cost == 0 ? cost : (m_cost * 7 + cost) / 8;
+
+    // 检查耗时占间隔的比例不超过 m_budget%
+    const qint64 interval = m_cost * 100 / m_budget / 1000000;
+    m_timer.start(static_cast<int>(qBound<qint64>(minInterval, interval, maxInterval)));
+}
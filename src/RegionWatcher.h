@@ -0,0 +1,49 @@
+﻿#ifndef REGIONWATCHER_H
+#define REGIONWATCHER_H
+
+#include <QObject>
+#include <QImage>
+#include <QTimer>
+#include <QVector>
+
+// 监视屏幕上的一块区域：定时截取并按分块计算哈希，与上次触发时相比变化的分块
+// 超过阈值时发出 changed；截图和哈希的耗时按 CPU 占用上限拉长检查间隔，
+// Linux 下先用 XDamage 判断区域有没有变化，没有变化时不截图
+class RegionWatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit RegionWatcher(QObject *parent = nullptr);
+    ~RegionWatcher();
+
+    // rect 为物理像素坐标
+    void start(const QRect &rect);
+    void stop();
+    bool isActive() const;
+    QRect rect() const;
+    // 变化的分块占所有分块的百分比达到 percent 时触发
+    void setThreshold(int percent);
+    // 检查占用单个核心的百分比上限
+    void setBudget(int percent);
+
+signals:
+    // image 为触发时的区域截图，不与其他图片共用数据
+    void changed(const QImage &image);
+
+private slots:
+    void check();
+
+private:
+    QRect m_rect;
+    QTimer m_timer;
+    QVector<quint64> m_baseline;
+    QVector<quint64> m_hashes;
+    int m_threshold;
+    int m_budget;
+    // 每次检查的平均耗时（纳秒）
+    qint64 m_cost;
+#ifdef Q_OS_LINUX
+    int m_damage;
+#endif // Q_OS_LINUX
+};
+
+#endif // REGIONWATCHER_H
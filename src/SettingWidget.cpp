@@ -1,5 +1,6 @@
 ﻿#include "SettingWidget.h"
 #include "ui_SettingWidget.h"
+#include "ImagePool.h"
 
 #include <QMessageBox>
 #include <QFileInfo>
@@ -26,7 +27,7 @@ QDataStream& operator>>(QDataStream& stream, HotKey &key) {
     return stream;
 }
 
-SettingWidget::SettingWidget(QWidget *parent): QWidget(parent), ui(new Ui::SettingWidget), m_scale_ctrl{true} {
+SettingWidget::SettingWidget(QWidget *parent): QWidget(parent), ui(new Ui::SettingWidget), m_scale_ctrl{true}, m_paint_dim{false}, m_save_limit{4}, m_progressive{false}, m_speculative{false}, m_memory_budget{1024}, m_window_capture{false}, m_watch_threshold{5}, m_watch_budget{2}, m_timelapse_interval{60}, m_history_count{10}, m_history_memory{128}, m_shared_export{false} {
     ui->setupUi(this);
     setWindowTitle("设置");
 
@@ -52,6 +53,16 @@ SettingWidget::SettingWidget(QWidget *parent): QWidget(parent), ui(new Ui::Setti
     ui->format->setCurrentIndex(index);
     m_save_format = ui->format->currentText();
     ui->ocr_setting->setVisible(false);
+#ifndef Q_OS_LINUX
+    // 依赖 XRecord 监听修饰键
+    ui->speculative->setVisible(false);
+    // 依赖 XComposite
+    ui->window_capture->setVisible(false);
+    // 依赖 memfd 和 Unix socket 传递 fd
+    ui->shared_export->setVisible(false);
+    // 依赖共享内存后端在后台线程截图
+    ui->progressive->setVisible(false);
+#endif // Q_OS_LINUX
 }
 
 SettingWidget::~SettingWidget() {
@@ -71,6 +82,69 @@ void SettingWidget::readConfig() {
         stream >> ocrArray;
         OcrInstance->restore(ocrArray);
 #endif
+        // 旧版本的配置文件没有下面的字段
+        bool paintDim = false;
+        qint32 saveLimit = 4;
+        stream >> paintDim;
+        if (stream.status() == QDataStream::Ok) {
+            m_paint_dim = paintDim;
+        }
+        stream >> saveLimit;
+        if (stream.status() == QDataStream::Ok) {
+            m_save_limit = qBound(ui->save_limit->minimum(), saveLimit, ui->save_limit->maximum());
+        }
+        bool progressive = false;
+        stream >> progressive;
+        if (stream.status() == QDataStream::Ok) {
+            m_progressive = progressive;
+        }
+        bool speculative = false;
+        stream >> speculative;
+        if (stream.status() == QDataStream::Ok) {
+            m_speculative = speculative;
+        }
+        qint32 memoryBudget = 1024;
+        stream >> memoryBudget;
+        if (stream.status() == QDataStream::Ok) {
+            m_memory_budget = qBound(ui->memory_budget->minimum(), memoryBudget, ui->memory_budget->maximum());
+        }
+        bool windowCapture = false;
+        stream >> windowCapture;
+        if (stream.status() == QDataStream::Ok) {
+            m_window_capture = windowCapture;
+        }
+        qint32 watchThreshold = 5;
+        stream >> watchThreshold;
+        if (stream.status() == QDataStream::Ok) {
+            m_watch_threshold = qBound(ui->watch_threshold->minimum(), watchThreshold, ui->watch_threshold->maximum());
+        }
+        qint32 watchBudget = 2;
+        stream >> watchBudget;
+        if (stream.status() == QDataStream::Ok) {
+            m_watch_budget = qBound(ui->watch_budget->minimum(), watchBudget, ui->watch_budget->maximum());
+        }
+        qint32 timelapseInterval = 60;
+        stream >> timelapseInterval;
+        if (stream.status() == QDataStream::Ok) {
+            m_timelapse_interval = qBound(ui->timelapse_interval->minimum(), timelapseInterval, ui->timelapse_interval->maximum());
+        }
+        qint32 historyCount = 10;
+        stream >> historyCount;
+        if (stream.status() == QDataStream::Ok) {
+            m_history_count = qBound(ui->history_count->minimum(), historyCount, ui->history_count->maximum());
+        }
+        qint32 historyMemory = 128;
+        stream >> historyMemory;
+        if (stream.status() == QDataStream::Ok) {
+            m_history_memory = qBound(ui->history_memory->minimum(), historyMemory, ui->history_memory->maximum());
+        }
+        bool sharedExport = false;
+        stream >> sharedExport;
+        if (stream.status() == QDataStream::Ok) {
+            m_shared_export = sharedExport;
+        }
+        emit sharedExportChanged(m_shared_export);
+        ImagePool::instance()->setBudget(static_cast<qint64>(m_memory_budget) * 1024 * 1024);
         checkData(m_auto_save_key);
         checkData(m_capture);
         checkData(m_record);
@@ -99,6 +173,18 @@ void SettingWidget::readConfig() {
         }
         ui->radioButton->setChecked(m_scale_ctrl);
         ui->radioButton_2->setChecked(! m_scale_ctrl);
+        ui->paint_dim->setChecked(m_paint_dim);
+        ui->save_limit->setValue(m_save_limit);
+        ui->progressive->setChecked(m_progressive);
+        ui->speculative->setChecked(m_speculative);
+        ui->memory_budget->setValue(m_memory_budget);
+        ui->window_capture->setChecked(m_window_capture);
+        ui->watch_threshold->setValue(m_watch_threshold);
+        ui->watch_budget->setValue(m_watch_budget);
+        ui->timelapse_interval->setValue(m_timelapse_interval);
+        ui->history_count->setValue(m_history_count);
+        ui->history_memory->setValue(m_history_memory);
+        ui->shared_export->setChecked(m_shared_export);
         emit scaleKeyChanged(m_scale_ctrl);
         file.close();
     } else {
@@ -117,6 +203,9 @@ void SettingWidget::saveConfig() {
         QByteArray ocrArray = OcrInstance->save();
         stream << ocrArray;
 #endif
+        stream << m_paint_dim << static_cast<qint32>(m_save_limit) << m_progressive << m_speculative << static_cast<qint32>(m_memory_budget) << m_window_capture
+               << static_cast<qint32>(m_watch_threshold) << static_cast<qint32>(m_watch_budget) << static_cast<qint32>(m_timelapse_interval)
+               << static_cast<qint32>(m_history_count) << static_cast<qint32>(m_history_memory) << m_shared_export;
         file.flush();
         file.close();
     } else {
@@ -163,6 +252,18 @@ void SettingWidget::showEvent(QShowEvent *event) {
     updateKey1();
     updateKey2();
     updateKey3();
+    ui->paint_dim->setChecked(m_paint_dim);
+    ui->save_limit->setValue(m_save_limit);
+    ui->progressive->setChecked(m_progressive);
+    ui->speculative->setChecked(m_speculative);
+    ui->memory_budget->setValue(m_memory_budget);
+    ui->window_capture->setChecked(m_window_capture);
+    ui->watch_threshold->setValue(m_watch_threshold);
+    ui->watch_budget->setValue(m_watch_budget);
+    ui->timelapse_interval->setValue(m_timelapse_interval);
+    ui->history_count->setValue(m_history_count);
+    ui->history_memory->setValue(m_history_memory);
+    ui->shared_export->setChecked(m_shared_export);
     bool b1 = isSelfStart(true);
     bool b2 = isSelfStart(false);
     if (b1 && b2) {
@@ -417,6 +518,56 @@ void SettingWidget::confirm() {
         m_scale_ctrl = ui->radioButton->isChecked();
         emit scaleKeyChanged(m_scale_ctrl);
     }
+    if (m_paint_dim != ui->paint_dim->isChecked()) {
+        save = true;
+        m_paint_dim = ui->paint_dim->isChecked();
+    }
+    if (m_save_limit != ui->save_limit->value()) {
+        save = true;
+        m_save_limit = ui->save_limit->value();
+    }
+    if (m_progressive != ui->progressive->isChecked()) {
+        save = true;
+        m_progressive = ui->progressive->isChecked();
+    }
+    if (m_speculative != ui->speculative->isChecked()) {
+        save = true;
+        m_speculative = ui->speculative->isChecked();
+    }
+    if (m_memory_budget != ui->memory_budget->value()) {
+        save = true;
+        m_memory_budget = ui->memory_budget->value();
+        ImagePool::instance()->setBudget(static_cast<qint64>(m_memory_budget) * 1024 * 1024);
+    }
+    if (m_window_capture != ui->window_capture->isChecked()) {
+        save = true;
+        m_window_capture = ui->window_capture->isChecked();
+    }
+    if (m_watch_threshold != ui->watch_threshold->value()) {
+        save = true;
+        m_watch_threshold = ui->watch_threshold->value();
+    }
+    if (m_watch_budget != ui->watch_budget->value()) {
+        save = true;
+        m_watch_budget = ui->watch_budget->value();
+    }
+    if (m_timelapse_interval != ui->timelapse_interval->value()) {
+        save = true;
+        m_timelapse_interval = ui->timelapse_interval->value();
+    }
+    if (m_history_count != ui->history_count->value()) {
+        save = true;
+        m_history_count = ui->history_count->value();
+    }
+    if (m_history_memory != ui->history_memory->value()) {
+        save = true;
+        m_history_memory = ui->history_memory->value();
+    }
+    if (m_shared_export != ui->shared_export->isChecked()) {
+        save = true;
+        m_shared_export = ui->shared_export->isChecked();
+        emit sharedExportChanged(m_shared_export);
+    }
 
     if (save) {
         saveConfig();
@@ -434,6 +585,13 @@ void SettingWidget::keyHelp() {
                                "<li><b>C</b>: 复制鼠标位置的 RGB 到剪贴板</li>"
                                "<li><b>← ↑ → ↓</b>: 微调位置</li>"
                                "</ul>"
+                               "<h3>截图</h3>"
+                               "<ul>"
+                               "<li><b>W</b>: 监视选区，变化时保存到自动保存目录</li>"
+                               "<li><b>T</b>: 定时截取选区，保存到自动保存目录</li>"
+                               "<li><b>A</b>: 加入批量截图，继续选择下一块区域</li>"
+                               "<li><b>B</b>: 批量截图（包括当前选区）保存到自动保存目录</li>"
+                               "</ul>"
                                "<h3>置顶窗口</h3>"
                                "<ul>"
                                "<li><b>%1</b>: 长截图上下滑动</li>"
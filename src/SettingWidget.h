@@ -42,12 +42,25 @@ public:
     inline const HotKey& capture() const { return m_capture; }
     inline const HotKey& record() const { return m_record; }
     inline bool scaleCtrl() const { return m_scale_ctrl; }
+    inline bool paintDim() const { return m_paint_dim; }
+    inline int saveLimit() const { return m_save_limit; }
+    inline bool progressive() const { return m_progressive; }
+    inline bool speculative() const { return m_speculative; }
+    inline int memoryBudget() const { return m_memory_budget; }
+    inline bool windowCapture() const { return m_window_capture; }
+    inline int watchThreshold() const { return m_watch_threshold; }
+    inline int watchBudget() const { return m_watch_budget; }
+    inline int timelapseInterval() const { return m_timelapse_interval; }
+    inline int historyCount() const { return m_history_count; }
+    inline int historyMemory() const { return m_history_memory; }
+    inline bool sharedExport() const { return m_shared_export; }
 
 signals:
     void autoSaveChanged(const HotKey &key, quint8 mode, const QString &path);
     void captureChanged(const HotKey &key);
     void recordChanged(const HotKey &key);
     void scaleKeyChanged(bool value);
+    void sharedExportChanged(bool enable);
 
 protected:
     void showEvent(QShowEvent *event) override;
@@ -80,6 +93,18 @@ private:
     HotKey m_capture;
     HotKey m_record;
     bool m_scale_ctrl;
+    bool m_paint_dim;
+    int m_save_limit;
+    bool m_progressive;
+    bool m_speculative;
+    int m_memory_budget;
+    bool m_window_capture;
+    int m_watch_threshold;
+    int m_watch_budget;
+    int m_timelapse_interval;
+    int m_history_count;
+    int m_history_memory;
+    bool m_shared_export;
 
     QPoint m_pos;
 };
@@ -0,0 +1,91 @@
+﻿#include "Timelapse.h"
+#include "CaptureEngine.h"
+#include "ImageKernel.h"
+
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include "DamageMonitor.h"
+#endif // Q_OS_LINUX
+
+Timelapse::Timelapse(QObject *parent): QObject{parent}, m_hash{0}, m_has_hash{false}, m_captured{0}, m_skipped{0} {
+#ifdef Q_OS_LINUX
+    m_damage = -1;
+#endif // Q_OS_LINUX
+    // 间隔以秒计，允许合并唤醒
+    m_timer.setTimerType(Qt::VeryCoarseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &Timelapse::capture);
+}
+
+Timelapse::~Timelapse() {
+    stop();
+}
+
+void Timelapse::start(const QRect &rect, int interval) {
+    stop();
+    m_rect = rect;
+    m_has_hash = false;
+    m_captured = 0;
+    m_skipped = 0;
+#ifdef Q_OS_LINUX
+    m_damage = DamageMonitor::instance()->subscribe(target());
+#endif // Q_OS_LINUX
+    const QRect area = target();
+    qInfo().noquote() << QString("开始定时截图:(%1,%2 %3x%4) 间隔%5s")
+                             .arg(area.x()).arg(area.y()).arg(area.width()).arg(area.height()).arg(interval);
+    m_timer.start(qMax(1, interval) * 1000);
+}
+
+void Timelapse::stop() {
+    if (! m_timer.isActive()) return;
+    m_timer.stop();
+#ifdef Q_OS_LINUX
+    if (m_damage != -1) {
+        DamageMonitor::instance()->unsubscribe(m_damage);
+        m_damage = -1;
+    }
+#endif // Q_OS_LINUX
+    qInfo() << "停止定时截图，保存" << m_captured << "张，跳过" << m_skipped << "张";
+}
+
+bool Timelapse::isActive() const {
+    return m_timer.isActive();
+}
+
+int Timelapse::captured() const {
+    return m_captured;
+}
+
+int Timelapse::skipped() const {
+    return m_skipped;
+}
+
+void Timelapse::resetHash() {
+    m_has_hash = false;
+}
+
+QRect Timelapse::target() const {
+    if (! m_rect.isEmpty()) return m_rect;
+    return {QPoint{0, 0}, CaptureEngine::instance()->desktopSize()};
+}
+
+void Timelapse::capture() {
+#ifdef Q_OS_LINUX
+    // 第一帧之后区域内没有重绘说明内容不变
+    if (m_damage != -1 && m_has_hash && DamageMonitor::instance()->take(m_damage).isEmpty()) {
+        ++m_skipped;
+        return;
+    }
+#endif // Q_OS_LINUX
+    QImage image = CaptureEngine::instance()->grabRegion(target(), QImage::Format_RGB32);
+    if (image.isNull()) return;
+    // 重绘不一定改变内容，比较整张图片的哈希
+    const quint64 hash = imageHash(image);
+    if (m_has_hash && hash == m_hash) {
+        ++m_skipped;
+        return;
+    }
+    m_hash = hash;
+    m_has_hash = true;
+    ++m_captured;
+    emit frame(image);
+}
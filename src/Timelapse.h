@@ -0,0 +1,46 @@
+﻿#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include <QObject>
+#include <QImage>
+#include <QTimer>
+
+// 定时截取一块区域或整个桌面，与上次交出去的一帧内容相同时跳过，不产生重复的文件；
+// Linux 下区域没有重绘时连截图都省掉
+class Timelapse : public QObject {
+    Q_OBJECT
+public:
+    explicit Timelapse(QObject *parent = nullptr);
+    ~Timelapse();
+
+    // rect 为物理像素坐标，为空时截取整个桌面；interval 为秒
+    void start(const QRect &rect, int interval);
+    void stop();
+    bool isActive() const;
+    int captured() const;
+    int skipped() const;
+    // 上一帧没能保存时调用，下一次即使内容相同也交出去
+    void resetHash();
+
+signals:
+    // image 不与其他图片共用数据
+    void frame(const QImage &image);
+
+private slots:
+    void capture();
+
+private:
+    QRect target() const;
+
+    QRect m_rect;
+    QTimer m_timer;
+    quint64 m_hash;
+    bool m_has_hash;
+    int m_captured;
+    int m_skipped;
+#ifdef Q_OS_LINUX
+    int m_damage;
+#endif // Q_OS_LINUX
+};
+
+#endif // TIMELAPSE_H
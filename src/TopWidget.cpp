@@ -1,5 +1,6 @@
 ﻿#include "TopWidget.h"
 #include "mainwindow.h"
+#include "ImagePool.h"
 
 #include <QTimer>
 #include <QtMath>
@@ -7,11 +8,18 @@
 #include <QPushButton>
 
 #ifdef Q_OS_LINUX
+#include "CaptureEngine.h"
+#include "DamageMonitor.h"
 #include <X11/Xlib.h>
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
 #include <QX11Info>
 #endif
 #undef KeyPress
+
+// 实时刷新的最短间隔（毫秒）
+static constexpr qint64 liveInterval = 33;
+// 变化区域过于零碎时直接截取外接矩形
+static constexpr int maxLiveRects = 16;
 #endif
 
 TopWidget::TopWidget(QImage &image, const QRect &rect, QMenu *menu, qreal ratio): m_max_offset{image.height() - qRound(rect.height() * ratio)}, m_origin{rect.size()} {
@@ -65,6 +73,16 @@ TopWidget::TopWidget(QImage &image, QPainterPath &&path, QVector<Shape *> &vecto
 TopWidget::~TopWidget() {
     delete m_menu;
     m_menu = nullptr;
+#ifdef Q_OS_LINUX
+    if (m_live_timer != -1) {
+        killTimer(m_live_timer);
+        m_live_timer = -1;
+    }
+    if (m_damage != -1) {
+        DamageMonitor::instance()->unsubscribe(m_damage);
+        m_damage = -1;
+    }
+#endif // Q_OS_LINUX
     if (m_scroll_timer != -1) {
         killTimer(m_scroll_timer);
         m_scroll_timer = -1;
@@ -293,6 +311,14 @@ void TopWidget::timerEvent(QTimerEvent *event) {
         killTimer(m_ratio_timer);
         m_ratio_timer = -1;
         update();
+#ifdef Q_OS_LINUX
+    } else if (event->timerId() == m_live_timer) {
+        killTimer(m_live_timer);
+        m_live_timer = -1;
+        if (m_damage != -1) {
+            refreshLive(DamageMonitor::instance()->take(m_damage));
+        }
+#endif // Q_OS_LINUX
 #ifdef OCR
     } else if (event->timerId() == m_ocr_timer) {
         m_angle = (m_angle + 30) % 360;
@@ -825,6 +851,104 @@ void TopWidget::copyImage() {
     }
 }
 
+void TopWidget::shrink() {
+    clearStack();
+#ifdef Q_OS_LINUX
+    // 实时刷新直接把截图写进 m_image，需要保持 32 位
+    if (m_damage != -1) return;
+#endif // Q_OS_LINUX
+    // 不透明的图片改成 24 位，少占四分之一的内存
+    if (m_image.format() != QImage::Format_RGB32) return;
+    QImage image = ImagePool::instance()->acquire(m_image.size(), QImage::Format_RGB888, ImagePool::Pin);
+    if (image.isNull()) return;
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, m_image);
+    painter.end();
+    m_image.swap(image);
+}
+
+#ifdef Q_OS_LINUX
+void TopWidget::setSource(const QRect &native) {
+    m_source = {native.topLeft(), m_image.size()};
+    m_live->setVisible(m_path.elementCount() < 2 && m_max_offset <= 0 && DamageMonitor::instance()->isValid());
+}
+
+void TopWidget::liveChanged(bool live) {
+    DamageMonitor *monitor = DamageMonitor::instance();
+    if (! live) {
+        if (m_live_timer != -1) {
+            killTimer(m_live_timer);
+            m_live_timer = -1;
+        }
+        if (m_damage != -1) {
+            monitor->unsubscribe(m_damage);
+            m_damage = -1;
+        }
+        return;
+    }
+    if (m_damage != -1 || m_source.isEmpty()) return;
+    // shrink 之后可能已经是 24 位
+    if (m_image.format() != QImage::Format_RGB32) {
+        QImage image = ImagePool::instance()->acquire(m_image.size(), QImage::Format_RGB32, ImagePool::Pin);
+        if (image.isNull()) {
+            m_live->setChecked(false);
+            return;
+        }
+        QPainter painter(&image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, m_image);
+        painter.end();
+        m_image.swap(image);
+    }
+    // 通知里只启动定时器，不在 DamageMonitor 的调用栈里截图
+    m_damage = monitor->subscribe(m_source, [this]() {
+        if (m_live_timer != -1) return;
+        m_live_timer = startTimer(qMax<qint64>(liveInterval - m_live_time.elapsed(), 0), Qt::PreciseTimer);
+    });
+    if (m_damage == -1) {
+        m_live->setChecked(false);
+        addTip("不支持实时刷新");
+        return;
+    }
+    if (nativeGeometry().intersects(m_source)) {
+        addTip("窗口盖住的部分移开后才会刷新");
+    }
+    // 订阅之前的变化不会通知，先整体刷新一次
+    refreshLive(QRegion{m_image.rect()});
+}
+
+void TopWidget::refreshLive(const QRegion &region) {
+    m_live_time.start();
+    QRegion dirty = region.rectCount() > maxLiveRects ? QRegion{region.boundingRect()} : region;
+    // 窗口盖住截图区域时截到的是窗口自己，这部分保留原来的内容，否则窗口重绘又会产生新的变化
+    dirty -= nativeGeometry().translated(- m_source.topLeft());
+    dirty &= m_image.rect();
+    if (dirty.isEmpty()) return;
+
+    CaptureEngine *engine = CaptureEngine::instance();
+    const qsizetype bpl = m_image.bytesPerLine();
+    uchar *bits = m_image.bits();
+    for (auto iter = dirty.begin(); iter != dirty.end(); ++iter) {
+        QImage view{bits + iter->y() * bpl + iter->x() * 4, iter->width(), iter->height(), bpl, m_image.format()};
+        engine->grabInto(view, iter->translated(m_source.topLeft()));
+    }
+    update();
+}
+
+QRect TopWidget::nativeGeometry() const {
+    const QRect rect = geometry();
+    const QVector<CaptureEngine::ScreenInfo> screens = CaptureEngine::instance()->screens();
+    for (auto iter = screens.cbegin(); iter != screens.cend(); ++iter) {
+        if (iter->geometry.contains(rect.topLeft())) {
+            const QPoint offset = rect.topLeft() - iter->geometry.topLeft();
+            return {iter->native.topLeft() + offset * iter->ratio, rect.size() * iter->ratio};
+        }
+    }
+    return rect;
+}
+#endif // Q_OS_LINUX
+
 void TopWidget::copyWidget() {
     TopWidget *t = nullptr;
     if (m_path.elementCount() >= 2) {
@@ -907,6 +1031,7 @@ void TopWidget::init() {
     connect(m_tool, &Tool::clickTop, m_tool, &Tool::topChange);
     connect(m_tool, &Tool::topChanged, this, &TopWidget::topChange);
     connect(m_tool, &Tool::opacityChanged, this, &TopWidget::updateOpacity);
+    connect(ImagePool::instance(), &ImagePool::pressure, this, &TopWidget::shrink);
 
     QString text = QString("(%1,%2 %3x%4)").arg(x()).arg(y()).arg(m_image.width()).arg(m_image.height());
 
@@ -945,6 +1070,12 @@ void TopWidget::init() {
     m_lock_pos->setCheckable(true);
     m_lock_scale = m_right_menu->addAction("锁定大小");
     m_lock_scale->setCheckable(true);
+#ifdef Q_OS_LINUX
+    m_live = m_right_menu->addAction("实时刷新");
+    m_live->setCheckable(true);
+    m_live->setVisible(false);
+    connect(m_live, &QAction::toggled, this, &TopWidget::liveChanged);
+#endif // Q_OS_LINUX
     // m_right_menu->addAction("阴影");
     m_right_menu->addSeparator();
     m_right_menu->addAction("关闭", this, &TopWidget::close);
@@ -5,6 +5,7 @@
 #include <QMenu>
 #include <QTextEdit>
 #include <QLabel>
+#include <QElapsedTimer>
 
 #include "BaseWindow.h"
 #ifdef OCR
@@ -27,6 +28,10 @@ public:
     explicit TopWidget(QImage &image, QPainterPath &&path, QVector<Shape*> &vector, const QRect &rect, QMenu *menu, qreal ratio);
     virtual ~TopWidget();
     void showTool();
+#ifdef Q_OS_LINUX
+    // native 为截图区域的物理像素坐标，设置后可以在右键菜单里开启实时刷新
+    void setSource(const QRect &native);
+#endif // Q_OS_LINUX
 
 public slots:
     void scaleKeyChanged(bool value);
@@ -69,6 +74,11 @@ private slots:
     void updateOpacity(int value);
     void copyImage();
     void copyWidget();
+    // 图片内存超出预算时释放撤销记录并压缩图片
+    void shrink();
+#ifdef Q_OS_LINUX
+    void liveChanged(bool live);
+#endif // Q_OS_LINUX
 #if defined (OCR) || defined (QRCODE)
     void copyText();
     void editText();
@@ -80,6 +90,11 @@ private:
     void scaleWidget(int delta);
     void scaleWidget(float ratio);
     void scrollWidget(int delta);
+#ifdef Q_OS_LINUX
+    // region 相对于截图区域左上角，只截取变化的部分
+    void refreshLive(const QRegion &region);
+    QRect nativeGeometry() const;
+#endif // Q_OS_LINUX
 #if defined (OCR) || defined (QRCODE)
     void hideWidget();
 #endif // defined (OCR) || defined (QRCODE)
@@ -110,6 +125,12 @@ private:
 
 #ifdef Q_OS_LINUX
     bool m_move = false;
+    // 实时刷新：DamageMonitor 通知区域有变化后截取变化部分，最多每秒 30 次
+    QRect m_source;
+    int m_damage = -1;
+    int m_live_timer = -1;
+    QElapsedTimer m_live_time;
+    QAction *m_live = nullptr;
 #endif // Q_OS_LINUX
 
     int m_offsetY = 0;
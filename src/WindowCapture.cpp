@@ -0,0 +1,163 @@
+﻿#include "WindowCapture.h"
+#include "ImagePool.h"
+#include "XErrorTrap.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xcomposite.h>
+
+struct WindowCapture::Private {
+    Display *display = nullptr;
+    bool valid = false;
+    bool shm = false;
+    Atom cmAtom = 0;
+};
+
+WindowCapture::WindowCapture(): d{new Private} {
+    d->display = XOpenDisplay(nullptr);
+    if (d->display == nullptr) {
+        qWarning() << "XComposite: 无法打开display";
+        return;
+    }
+    int eventBase, errorBase;
+    int major = 0, minor = 2;
+    // NameWindowPixmap 需要 0.2 以上的版本
+    if (! XCompositeQueryExtension(d->display, &eventBase, &errorBase) ||
+        ! XCompositeQueryVersion(d->display, &major, &minor) || (major == 0 && minor < 2)) {
+        qWarning() << "XComposite: 不支持Composite扩展";
+        return;
+    }
+    d->shm = XShmQueryExtension(d->display);
+    const QByteArray name = QByteArray("_NET_WM_CM_S") + QByteArray::number(DefaultScreen(d->display));
+    d->cmAtom = XInternAtom(d->display, name.constData(), False);
+    d->valid = true;
+}
+
+WindowCapture::~WindowCapture() {
+    if (d->display != nullptr) {
+        XCloseDisplay(d->display);
+        d->display = nullptr;
+    }
+    delete d;
+    d = nullptr;
+}
+
+bool WindowCapture::isValid() const {
+    return d->valid;
+}
+
+bool WindowCapture::compositorActive() {
+    return XGetSelectionOwner(d->display, d->cmAtom) != 0;
+}
+
+// 从 pixmap 读取 width x height 的内容，优先使用共享内存
+static XImage* getImage(Display *display, bool shm, Pixmap pixmap, Visual *visual, int depth, int x, int y, int width, int height,
+                        XShmSegmentInfo *shminfo, XErrorTrap &trap) {
+    if (shm) {
+        XImage *ximage = XShmCreateImage(display, visual, depth, ZPixmap, nullptr, shminfo, width, height);
+        if (ximage != nullptr) {
+            shminfo->shmid = shmget(IPC_PRIVATE, static_cast<size_t>(ximage->bytes_per_line) * ximage->height, IPC_CREAT | 0600);
+            shminfo->shmaddr = shminfo->shmid < 0 ? reinterpret_cast<char*>(-1) : static_cast<char*>(shmat(shminfo->shmid, nullptr, 0));
+            if (shminfo->shmaddr != reinterpret_cast<char*>(-1)) {
+                shminfo->readOnly = False;
+                ximage->data = shminfo->shmaddr;
+                trap.reset();
+                XShmAttach(display, shminfo);
+                XSync(display, False);
+                shmctl(shminfo->shmid, IPC_RMID, nullptr);
+                if (! trap.hasError() && XShmGetImage(display, pixmap, ximage, x, y, AllPlanes)) {
+                    return ximage;
+                }
+                if (! trap.hasError()) {
+                    XShmDetach(display, shminfo);
+                }
+                shmdt(shminfo->shmaddr);
+            } else if (shminfo->shmid >= 0) {
+                shmctl(shminfo->shmid, IPC_RMID, nullptr);
+            }
+            shminfo->shmaddr = nullptr;
+            ximage->data = nullptr;
+            XDestroyImage(ximage);
+        }
+    }
+    trap.reset();
+    XImage *ximage = XGetImage(display, pixmap, x, y, width, height, AllPlanes, ZPixmap);
+    XSync(display, False);
+    return trap.hasError() ? nullptr : ximage;
+}
+
+QImage WindowCapture::grab(unsigned long window) {
+    QMutexLocker locker{&m_mutex};
+    if (! d->valid || window == 0) return {};
+    if (! compositorActive()) {
+        qDebug() << "XComposite: 没有运行合成器，被遮挡的部分没有内容";
+        return {};
+    }
+
+    XErrorTrap trap{d->display};
+    XWindowAttributes attributes;
+    if (! XGetWindowAttributes(d->display, window, &attributes) || trap.hasError() || attributes.map_state != IsViewable) {
+        return {};
+    }
+    // 只处理 0xRRGGBB 排列的 TrueColor 窗口
+    Visual *visual = attributes.visual;
+    if ((attributes.depth != 24 && attributes.depth != 32) ||
+        visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff ||
+        ImageByteOrder(d->display) != LSBFirst) {
+        return {};
+    }
+
+    // 合成器已经重定向的窗口这里只增加引用；全屏时合成器可能取消了重定向，需要重新重定向
+    XCompositeRedirectWindow(d->display, window, CompositeRedirectAutomatic);
+    Pixmap pixmap = XCompositeNameWindowPixmap(d->display, window);
+    XSync(d->display, False);
+
+    QImage image;
+    XShmSegmentInfo shminfo{};
+    XImage *ximage = nullptr;
+    if (! trap.hasError()) {
+        // pixmap 包含窗口边框
+        ximage = getImage(d->display, d->shm, pixmap, visual, attributes.depth, attributes.border_width, attributes.border_width,
+                          attributes.width, attributes.height, &shminfo, trap);
+    }
+    if (ximage != nullptr && ximage->bits_per_pixel == 32) {
+        const bool alpha = attributes.depth == 32;
+        image = ImagePool::instance()->acquire(QSize(ximage->width, ximage->height),
+                                               alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32,
+                                               ImagePool::Capture);
+        const size_t bytes = static_cast<size_t>(ximage->width) * 4;
+        for (int y = 0; ! image.isNull() && y < ximage->height; ++y) {
+            const char *line = ximage->data + static_cast<size_t>(y) * ximage->bytes_per_line;
+            memcpy(image.scanLine(y), line, bytes);
+            if (! alpha) {
+                // 24 位色深时填充字节的值不确定
+                quint32 *pixels = reinterpret_cast<quint32*>(image.scanLine(y));
+                for (int x = 0; x < ximage->width; ++x) {
+                    pixels[x] |= 0xff000000;
+                }
+            }
+        }
+    }
+    if (ximage != nullptr) {
+        if (shminfo.shmaddr != nullptr) {
+            XShmDetach(d->display, &shminfo);
+            XSync(d->display, False);
+            shmdt(shminfo.shmaddr);
+            ximage->data = nullptr;
+        }
+        XDestroyImage(ximage);
+    }
+    if (pixmap != 0) {
+        XFreePixmap(d->display, pixmap);
+    }
+    XCompositeUnredirectWindow(d->display, window, CompositeRedirectAutomatic);
+    XSync(d->display, False);
+    return image;
+}
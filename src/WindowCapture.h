@@ -0,0 +1,27 @@
+﻿#ifndef WINDOWCAPTURE_H
+#define WINDOWCAPTURE_H
+
+#include <QImage>
+#include <QMutex>
+
+// 通过 XComposite 读取窗口自己的后备缓冲，被其他窗口遮挡或者超出屏幕的部分也是正确的，
+// 只传输这个窗口的像素；需要合成器在运行，否则被遮挡部分没有内容，返回空图片
+class WindowCapture {
+    Q_DISABLE_COPY_MOVE(WindowCapture)
+public:
+    WindowCapture();
+    ~WindowCapture();
+
+    bool isValid() const;
+    // window 为 X 窗口 id，结果写入 ImagePool 的缓冲区，失败时返回空图片
+    QImage grab(unsigned long window);
+
+private:
+    bool compositorActive();
+
+    struct Private;
+    Private *d;
+    QMutex m_mutex;
+};
+
+#endif // WINDOWCAPTURE_H
@@ -0,0 +1,169 @@
+﻿#include "WindowIndex.h"
+
+#ifdef Q_OS_LINUX
+#include <QDebug>
+#include <xcb/xcb.h>
+#include <cstdlib>
+#endif // Q_OS_LINUX
+
+// 每个方向的格子数，窗口再多查找时也只检查一个格子
+static constexpr int gridSize = 32;
+
+void WindowIndex::reset(const QVector<QRect> &windows) {
+    clear();
+    m_windows = windows;
+    for (auto iter = windows.cbegin(); iter != windows.cend(); ++iter) {
+        m_bounds |= *iter;
+    }
+    if (m_bounds.isEmpty()) return;
+
+    m_cell_width = qMax(1, (m_bounds.width() + gridSize - 1) / gridSize);
+    m_cell_height = qMax(1, (m_bounds.height() + gridSize - 1) / gridSize);
+    m_cells.resize(gridSize * gridSize);
+    for (int i = 0; i < windows.size(); ++i) {
+        const QRect &rect = windows[i];
+        if (rect.isEmpty()) continue;
+        int left = (rect.left() - m_bounds.left()) / m_cell_width;
+        int right = (rect.right() - m_bounds.left()) / m_cell_width;
+        int top = (rect.top() - m_bounds.top()) / m_cell_height;
+        int bottom = (rect.bottom() - m_bounds.top()) / m_cell_height;
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = left; x <= right; ++x) {
+                m_cells[y * gridSize + x].push_back(i);
+            }
+        }
+    }
+}
+
+void WindowIndex::clear() {
+    m_windows.clear();
+    m_cells.clear();
+    m_bounds = QRect();
+}
+
+int WindowIndex::find(const QPoint &point) const {
+    if (! m_bounds.contains(point)) return -1;
+    int x = (point.x() - m_bounds.left()) / m_cell_width;
+    int y = (point.y() - m_bounds.top()) / m_cell_height;
+    // 格子内的下标是递增的，第一个命中的就是最上层的窗口
+    const QVector<int> &cell = m_cells[y * gridSize + x];
+    for (auto iter = cell.cbegin(); iter != cell.cend(); ++iter) {
+        if (m_windows[*iter].contains(point)) {
+            return *iter;
+        }
+    }
+    return -1;
+}
+
+#ifdef Q_OS_LINUX
+static xcb_atom_t internAtom(xcb_connection_t *connection, xcb_intern_atom_cookie_t cookie) {
+    xcb_atom_t atom = XCB_ATOM_NONE;
+    xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection, cookie, nullptr);
+    if (reply != nullptr) {
+        atom = reply->atom;
+        free(reply);
+    }
+    return atom;
+}
+
+QVector<QRect> WindowIndex::queryWindows(const QVector<quint32> &exclude) {
+    QVector<QRect> result;
+    int number = 0;
+    xcb_connection_t *connection = xcb_connect(nullptr, &number);
+    if (xcb_connection_has_error(connection)) {
+        qWarning() << "xcb: 连接失败";
+        xcb_disconnect(connection);
+        return result;
+    }
+    xcb_screen_iterator_t screens = xcb_setup_roots_iterator(xcb_get_setup(connection));
+    for (int i = 0; i < number && screens.rem > 0; ++i) {
+        xcb_screen_next(&screens);
+    }
+    const xcb_window_t root = screens.data->root;
+
+    auto stackingCookie = xcb_intern_atom(connection, 1, 26, "_NET_CLIENT_LIST_STACKING");
+    auto extentsCookie = xcb_intern_atom(connection, 1, 18, "_NET_FRAME_EXTENTS");
+    const xcb_atom_t stacking = internAtom(connection, stackingCookie);
+    const xcb_atom_t extents = internAtom(connection, extentsCookie);
+
+    // 优先使用窗口管理器提供的客户端列表，没有时退回到根窗口的子窗口
+    QVector<xcb_window_t> windows;
+    bool clients = false;
+    if (stacking != XCB_ATOM_NONE) {
+        auto cookie = xcb_get_property(connection, 0, root, stacking, XCB_ATOM_WINDOW, 0, UINT32_MAX / 4);
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(connection, cookie, nullptr);
+        if (reply != nullptr) {
+            int length = xcb_get_property_value_length(reply) / static_cast<int>(sizeof(xcb_window_t));
+            const xcb_window_t *value = static_cast<const xcb_window_t*>(xcb_get_property_value(reply));
+            for (int i = 0; i < length; ++i) {
+                windows.push_back(value[i]);
+            }
+            clients = length > 0;
+            free(reply);
+        }
+    }
+    if (! clients) {
+        xcb_query_tree_reply_t *reply = xcb_query_tree_reply(connection, xcb_query_tree(connection, root), nullptr);
+        if (reply != nullptr) {
+            int length = xcb_query_tree_children_length(reply);
+            const xcb_window_t *value = xcb_query_tree_children(reply);
+            for (int i = 0; i < length; ++i) {
+                windows.push_back(value[i]);
+            }
+            free(reply);
+        }
+    }
+
+    // 所有请求先发出去，再依次取回复，只有一次往返的延迟
+    const int count = windows.size();
+    QVector<xcb_get_window_attributes_cookie_t> attributes(count);
+    QVector<xcb_get_geometry_cookie_t> geometries(count);
+    QVector<xcb_translate_coordinates_cookie_t> positions(clients ? count : 0);
+    QVector<xcb_get_property_cookie_t> frames(clients && extents != XCB_ATOM_NONE ? count : 0);
+    for (int i = 0; i < count; ++i) {
+        attributes[i] = xcb_get_window_attributes(connection, windows[i]);
+        geometries[i] = xcb_get_geometry(connection, windows[i]);
+        if (! positions.isEmpty()) {
+            positions[i] = xcb_translate_coordinates(connection, windows[i], root, 0, 0);
+        }
+        if (! frames.isEmpty()) {
+            frames[i] = xcb_get_property(connection, 0, windows[i], extents, XCB_ATOM_CARDINAL, 0, 4);
+        }
+    }
+
+    QVector<QRect> rects(count);
+    for (int i = 0; i < count; ++i) {
+        xcb_get_window_attributes_reply_t *attribute = xcb_get_window_attributes_reply(connection, attributes[i], nullptr);
+        xcb_get_geometry_reply_t *geometry = xcb_get_geometry_reply(connection, geometries[i], nullptr);
+        xcb_translate_coordinates_reply_t *position = positions.isEmpty() ? nullptr : xcb_translate_coordinates_reply(connection, positions[i], nullptr);
+        xcb_get_property_reply_t *frame = frames.isEmpty() ? nullptr : xcb_get_property_reply(connection, frames[i], nullptr);
+
+        if (attribute != nullptr && geometry != nullptr && attribute->map_state == XCB_MAP_STATE_VIEWABLE &&
+            ! (geometry->width == geometry->height && geometry->width <= 5) && ! exclude.contains(windows[i])) {
+            QRect rect{geometry->x, geometry->y, geometry->width, geometry->height};
+            if (position != nullptr) {
+                rect.moveTo(position->dst_x, position->dst_y);
+            }
+            if (frame != nullptr && xcb_get_property_value_length(frame) >= 16) {
+                // left, right, top, bottom
+                const quint32 *value = static_cast<const quint32*>(xcb_get_property_value(frame));
+                rect.adjust(- static_cast<int>(value[0]), - static_cast<int>(value[2]), value[1], value[3]);
+            }
+            rects[i] = rect;
+        }
+        free(attribute);
+        free(geometry);
+        free(position);
+        free(frame);
+    }
+    xcb_disconnect(connection);
+
+    // 两种列表都是从下到上排列
+    for (int i = count - 1; i >= 0; --i) {
+        if (rects[i].isValid()) {
+            result.push_back(rects[i]);
+        }
+    }
+    return result;
+}
+#endif // Q_OS_LINUX
@@ -0,0 +1,31 @@
+﻿#ifndef WINDOWINDEX_H
+#define WINDOWINDEX_H
+
+#include <QVector>
+#include <QRect>
+
+// 截图时窗口吸附用的空间索引，把区域划分成固定数量的格子，
+// 每个格子按 z 序记录与之相交的窗口，查找时只需检查一个格子
+class WindowIndex {
+public:
+    // windows 按 z 序从上到下排列
+    void reset(const QVector<QRect> &windows);
+    void clear();
+    // 返回包含 point 的最上层窗口的下标，没有时返回 -1
+    int find(const QPoint &point) const;
+
+#ifdef Q_OS_LINUX
+    // 在新的 xcb 连接上批量查询顶层窗口，返回包含边框的物理像素坐标，按 z 序从上到下排列
+    // 会阻塞，需要在后台线程调用
+    static QVector<QRect> queryWindows(const QVector<quint32> &exclude);
+#endif // Q_OS_LINUX
+
+private:
+    QVector<QRect> m_windows;
+    QVector<QVector<int>> m_cells;
+    QRect m_bounds;
+    int m_cell_width = 1;
+    int m_cell_height = 1;
+};
+
+#endif // WINDOWINDEX_H
@@ -0,0 +1,41 @@
+﻿#include "XErrorTrap.h"
+
+#include <QMutex>
+#include <atomic>
+#include <X11/Xlib.h>
+
+// 以下变量只在持有 trapMutex 时修改，错误处理函数可能在其他线程调用，所以用原子变量
+static QMutex trapMutex;
+static std::atomic<Display*> trapDisplay{nullptr};
+static std::atomic<bool> trapError{false};
+static std::atomic<XErrorHandler> previousHandler{nullptr};
+
+static int trapErrorHandler(Display *display, XErrorEvent *error) {
+    if (display != trapDisplay.load()) {
+        const XErrorHandler handler = previousHandler.load();
+        return handler != nullptr ? handler(display, error) : 0;
+    }
+    trapError = true;
+    return 0;
+}
+
+XErrorTrap::XErrorTrap(Display *display) {
+    trapMutex.lock();
+    trapDisplay = display;
+    trapError = false;
+    previousHandler = XSetErrorHandler(trapErrorHandler);
+}
+
+XErrorTrap::~XErrorTrap() {
+    XSetErrorHandler(previousHandler.load());
+    trapDisplay = nullptr;
+    trapMutex.unlock();
+}
+
+bool XErrorTrap::hasError() const {
+    return trapError;
+}
+
+void XErrorTrap::reset() {
+    trapError = false;
+}
@@ -0,0 +1,21 @@
+﻿#ifndef XERRORTRAP_H
+#define XERRORTRAP_H
+
+#include <QtGlobal>
+
+typedef struct _XDisplay Display;
+
+// Xlib 的错误处理函数是进程全局的，各个截图后端临时替换时共用一把锁，
+// 不同线程同时替换和恢复不会互相覆盖；只记录 display 上的错误，其他连接的错误交给原来的处理函数
+class XErrorTrap {
+    Q_DISABLE_COPY_MOVE(XErrorTrap)
+public:
+    explicit XErrorTrap(Display *display);
+    ~XErrorTrap();
+
+    // 需要先 XSync 才能收到之前请求的错误
+    bool hasError() const;
+    void reset();
+};
+
+#endif // XERRORTRAP_H
@@ -0,0 +1,176 @@
+﻿#include "XShmCapture.h"
+#include "XErrorTrap.h"
+
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+struct XShmCapture::Private {
+    Display *display = nullptr;
+    Window root = 0;
+    Visual *visual = nullptr;
+    int depth = 0;
+    bool valid = false;
+    XShmSegmentInfo shminfo{};
+    size_t capacity = 0;
+    XImage *ximage = nullptr;
+};
+
+XShmCapture::XShmCapture(): d{new Private} {
+    d->display = XOpenDisplay(nullptr);
+    if (d->display == nullptr) {
+        qWarning() << "XShm: 无法打开display";
+        return;
+    }
+    if (! XShmQueryExtension(d->display)) {
+        qWarning() << "XShm: 不支持MIT-SHM扩展";
+        return;
+    }
+    int screen = DefaultScreen(d->display);
+    d->root = RootWindow(d->display, screen);
+    d->visual = DefaultVisual(d->display, screen);
+    d->depth = DefaultDepth(d->display, screen);
+    // 只处理 0xRRGGBB 排列的 32 位像素，其他格式走 grabWindow
+    if ((d->depth != 24 && d->depth != 32) ||
+        d->visual->red_mask != 0xff0000 || d->visual->green_mask != 0xff00 || d->visual->blue_mask != 0xff ||
+        ImageByteOrder(d->display) != LSBFirst) {
+        qWarning() << "XShm: 不支持的visual，depth:" << d->depth;
+        return;
+    }
+    d->valid = true;
+}
+
+XShmCapture::~XShmCapture() {
+    release();
+    if (d->display != nullptr) {
+        XCloseDisplay(d->display);
+        d->display = nullptr;
+    }
+    delete d;
+    d = nullptr;
+}
+
+bool XShmCapture::isValid() const {
+    return d->valid;
+}
+
+QSize XShmCapture::rootSize() const {
+    QMutexLocker locker{&m_mutex};
+    return queryRootSize();
+}
+
+QSize XShmCapture::queryRootSize() const {
+    if (d->display == nullptr) return {};
+    // DisplayWidth 来自打开连接时缓存的 Screen，热插拔显示器后不会更新，每次向服务器查询根窗口的大小
+    Window root;
+    int x, y;
+    unsigned int width, height, border, depth;
+    if (! XGetGeometry(d->display, d->root, &root, &x, &y, &width, &height, &border, &depth)) return {};
+    return QSize(static_cast<int>(width), static_cast<int>(height));
+}
+
+QImage XShmCapture::grab(const QRect &rect) {
+    QMutexLocker locker{&m_mutex};
+    if (! d->valid) return {};
+    const QRect source = rect.intersected(QRect{QPoint{0, 0}, queryRootSize()});
+    if (source.isEmpty() || ! ensure(source.size())) return {};
+
+    if (! XShmGetImage(d->display, d->root, d->ximage, source.x(), source.y(), AllPlanes)) {
+        qWarning() << "XShmGetImage失败" << source;
+        return {};
+    }
+    if (d->depth == 24) {
+        // 24 位色深时填充字节的值不确定，Format_RGB32 要求为 0xff
+        for (int y = 0; y < d->ximage->height; ++y) {
+            quint32 *line = reinterpret_cast<quint32*>(d->ximage->data + static_cast<size_t>(y) * d->ximage->bytes_per_line);
+            for (int x = 0; x < d->ximage->width; ++x) {
+                line[x] |= 0xff000000;
+            }
+        }
+    }
+    return QImage(reinterpret_cast<uchar*>(d->ximage->data), d->ximage->width, d->ximage->height,
+                  d->ximage->bytes_per_line, QImage::Format_RGB32);
+}
+
+bool XShmCapture::ensure(const QSize &size) {
+    if (d->ximage != nullptr && d->ximage->width == size.width() && d->ximage->height == size.height()) {
+        return true;
+    }
+    if (d->ximage != nullptr) {
+        d->ximage->data = nullptr;
+        XDestroyImage(d->ximage);
+        d->ximage = nullptr;
+    }
+
+    XImage *ximage = XShmCreateImage(d->display, d->visual, d->depth, ZPixmap, nullptr, &d->shminfo, size.width(), size.height());
+    if (ximage == nullptr || ximage->bits_per_pixel != 32) {
+        qWarning() << "XShmCreateImage失败";
+        if (ximage != nullptr) XDestroyImage(ximage);
+        d->valid = false;
+        return false;
+    }
+    size_t bytes = static_cast<size_t>(ximage->bytes_per_line) * ximage->height;
+    if (bytes > d->capacity) {
+        // 段只增不减，选区变小时直接复用
+        release();
+        d->shminfo.shmid = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600);
+        if (d->shminfo.shmid < 0) {
+            qWarning() << "shmget失败:" << strerror(errno);
+            XDestroyImage(ximage);
+            d->valid = false;
+            return false;
+        }
+        d->shminfo.shmaddr = static_cast<char*>(shmat(d->shminfo.shmid, nullptr, 0));
+        d->shminfo.readOnly = False;
+        if (d->shminfo.shmaddr == reinterpret_cast<char*>(-1)) {
+            qWarning() << "shmat失败:" << strerror(errno);
+            shmctl(d->shminfo.shmid, IPC_RMID, nullptr);
+            d->shminfo.shmaddr = nullptr;
+            XDestroyImage(ximage);
+            d->valid = false;
+            return false;
+        }
+
+        bool attached;
+        {
+            XErrorTrap trap{d->display};
+            XShmAttach(d->display, &d->shminfo);
+            XSync(d->display, False);
+            attached = ! trap.hasError();
+        }
+        // 标记删除，进程退出后由内核回收
+        shmctl(d->shminfo.shmid, IPC_RMID, nullptr);
+        if (! attached) {
+            qWarning() << "XShmAttach失败，可能是远程display";
+            shmdt(d->shminfo.shmaddr);
+            d->shminfo.shmaddr = nullptr;
+            XDestroyImage(ximage);
+            d->valid = false;
+            return false;
+        }
+        d->capacity = bytes;
+    }
+    ximage->data = d->shminfo.shmaddr;
+    d->ximage = ximage;
+    return true;
+}
+
+void XShmCapture::release() {
+    if (d->ximage != nullptr) {
+        d->ximage->data = nullptr;
+        XDestroyImage(d->ximage);
+        d->ximage = nullptr;
+    }
+    if (d->capacity > 0) {
+        XShmDetach(d->display, &d->shminfo);
+        XSync(d->display, False);
+        shmdt(d->shminfo.shmaddr);
+        d->shminfo.shmaddr = nullptr;
+        d->capacity = 0;
+    }
+}
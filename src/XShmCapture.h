@@ -0,0 +1,33 @@
+﻿#ifndef XSHMCAPTURE_H
+#define XSHMCAPTURE_H
+
+#include <QImage>
+#include <QMutex>
+#include <QRect>
+
+// 基于 MIT-SHM 的截图后端，XShmGetImage 直接写入常驻的共享内存段，
+// 返回的 QImage 直接指向共享内存，不做额外拷贝
+class XShmCapture {
+    Q_DISABLE_COPY_MOVE(XShmCapture)
+public:
+    XShmCapture();
+    ~XShmCapture();
+
+    bool isValid() const;
+    QSize rootSize() const;
+    // rect 为根窗口的物理像素坐标，失败时返回空图片
+    // 返回的图片与共享内存段共用数据，下一次 grab 之前有效，需要长期保存时调用 copy()
+    QImage grab(const QRect &rect);
+
+private:
+    // 调用时需要持有 m_mutex
+    QSize queryRootSize() const;
+    bool ensure(const QSize &size);
+    void release();
+
+    struct Private;
+    Private *d;
+    mutable QMutex m_mutex;
+};
+
+#endif // XSHMCAPTURE_H
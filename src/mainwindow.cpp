@@ -1,15 +1,72 @@
 ﻿#include "mainwindow.h"
 #include "TopWidget.h"
 #include "GifWidget.h"
+#include "CaptureEngine.h"
+#include "ImageKernel.h"
+#include "AutoSaver.h"
+#include "RegionWatcher.h"
+#include "Timelapse.h"
+#include "CaptureHistory.h"
 #ifdef LONG_SCREENSHOT
 #include "LongWidget.h"
 #endif // LONG_SCREENSHOT
+#ifdef Q_OS_LINUX
+#include "CaptureExport.h"
+#endif // Q_OS_LINUX
 
 #include <QShortcut>
 #include <QMessageBox>
 #include <QTimer>
 #include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QScreen>
+#include <QFile>
+#include <QtMath>
 #include <assert.h>
+#if defined(Q_OS_LINUX)
+#include <X11/Xatom.h>
+#elif defined(Q_OS_WINDOWS)
+#include <psapi.h>
+#endif
+
+// 结束截图后窗口停放在虚拟桌面左上角之外的距离
+static constexpr int parkOffset = 100;
+#ifdef Q_OS_LINUX
+// 预先截取的桌面超过这个时间（毫秒）没有使用就视为过时
+static constexpr qint64 standbyMaxAge = 1500;
+#endif // Q_OS_LINUX
+
+// 把进程的内存峰值重置为当前值，之后的 sessionRss 只反映这一次截图
+static void resetPeakRss() {
+#ifdef Q_OS_LINUX
+    // 写入 5 只重置 VmHWM（Linux 4.0 以上），不影响页面状态
+    QFile file{"/proc/self/clear_refs"};
+    if (file.open(QFile::WriteOnly)) {
+        file.write("5");
+    }
+#endif // Q_OS_LINUX
+}
+
+// 单位 KB。Linux 下是 resetPeakRss 之后的内存峰值；Windows 不能重置峰值，返回当前的工作集
+static qint64 sessionRss() {
+#if defined(Q_OS_LINUX)
+    QFile file{"/proc/self/status"};
+    if (file.open(QFile::ReadOnly)) {
+        const QList<QByteArray> lines = file.readAll().split('\n');
+        for (auto iter = lines.cbegin(); iter != lines.cend(); ++iter) {
+            if (iter->startsWith("VmHWM:")) {
+                return iter->mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+#elif defined(Q_OS_WINDOWS)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<qint64>(counters.WorkingSetSize / 1024);
+    }
+#endif
+    return -1;
+}
 
 MainWindow *MainWindow::self = nullptr;
 MainWindow *MainWindow::instance() {
@@ -17,17 +74,26 @@ MainWindow *MainWindow::instance() {
 }
 
 MainWindow::MainWindow(QWidget *parent): BaseWindow(parent),
-    m_state{State::Null}, m_resize{ResizeImage::NoResize}, m_gif{false}, m_setting{new SettingWidget} {
+    m_state{State::Null}, m_resize{ResizeImage::NoResize}, m_paint_dim{false}, m_gif{false}, m_setting{new SettingWidget}, m_saver{new AutoSaver}, m_watcher{new RegionWatcher}, m_timelapse{new Timelapse}, m_history{new CaptureHistory} {
 
     assert(MainWindow::self == nullptr);
     MainWindow::self = this;
     initTray();
 #ifdef Q_OS_LINUX
+    m_export = new CaptureExport(this);
+    connect(m_setting, &SettingWidget::sharedExportChanged, this, [this](bool enable) {
+        if (enable) {
+            m_export->start();
+        } else {
+            m_export->stop();
+        }
+    });
     m_monitor = new KeyMouseEvent;
     m_monitor->start();
     m_monitor->resume();
     // connect(m_monitor, &KeyMouseEvent::keyPress, this, &MainWindow::keyPress);
     connect(m_monitor, &KeyMouseEvent::mouseWheel, this, &MainWindow::mouseWheel);
+    connect(m_monitor, &KeyMouseEvent::modifiersChanged, this, &MainWindow::modifiersChanged);
     connect(this, &MainWindow::started, this, &MainWindow::grabMouseEvent);
     qApp->installNativeEventFilter(this);
     XSetErrorHandler(handleError);
@@ -48,12 +114,32 @@ MainWindow::MainWindow(QWidget *parent): BaseWindow(parent),
     connect(m_setting, &SettingWidget::autoSaveChanged, this, &MainWindow::updateAutoSave);
     connect(m_setting, &SettingWidget::captureChanged, this, &MainWindow::updateCapture);
     connect(m_setting, &SettingWidget::recordChanged, this, &MainWindow::updateRecord);
+    connect(m_saver, &AutoSaver::saved, this, &MainWindow::imageSaved);
+    connect(m_watcher, &RegionWatcher::changed, this, [this](const QImage &image) {
+        if (saveFrame(image, "区域监视", false) == InvalidPath) {
+            m_watcher->stop();
+            m_watch_action->setVisible(false);
+        }
+    });
+    connect(ImagePool::instance(), &ImagePool::pressure, m_history, &CaptureHistory::shrink);
+    connect(m_timelapse, &Timelapse::frame, this, [this](const QImage &image) {
+        const SaveResult result = saveFrame(image, "定时截图", true);
+        if (result == InvalidPath) {
+            stopTimelapse();
+        } else if (result == QueueFull) {
+            m_timelapse->resetHash();
+        }
+    });
     QTimer::singleShot(200, this, [this]() { m_setting->readConfig(); });
 }
 
 MainWindow::~MainWindow() {
     MainWindow::self = nullptr;
     safeDelete(m_setting);
+    safeDelete(m_watcher);
+    safeDelete(m_timelapse);
+    safeDelete(m_history);
+    safeDelete(m_saver);
 
 #if defined(Q_OS_LINUX)
     UnregisterHotKey(m_key1);
@@ -67,6 +153,15 @@ MainWindow::~MainWindow() {
     UnregisterHotKey((HWND)this->winId(), 2);
     UnregisterHotKey((HWND)this->winId(), 3);
 #endif // Q_OS_WINDOWS
+    if (m_window_thread.joinable()) {
+        m_window_thread.join();
+    }
+    if (m_screen_thread.joinable()) {
+        m_screen_thread.join();
+    }
+    if (m_dim_thread.joinable()) {
+        m_dim_thread.join();
+    }
 }
 
 void MainWindow::connectTopWidget(TopWidget *t) {
@@ -85,7 +180,7 @@ bool MainWindow::nativeEventFilter(const QByteArray &eventType, void *message, l
 #endif // QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
     Q_UNUSED(eventType);
     Q_UNUSED(result);
-    if (! this->isVisible()) {
+    if (! m_session) {
         auto *genericEvent = static_cast<xcb_generic_event_t *>(message);
         if (genericEvent->response_type == XCB_KEY_PRESS) {
             xcb_key_press_event_t event = *static_cast<xcb_key_press_event_t *>(message);
@@ -94,8 +189,10 @@ bool MainWindow::nativeEventFilter(const QByteArray &eventType, void *message, l
             if (modifiers == m_key1.modifiers && event.detail == m_key1.key) {
                 saveImage();
             } else if (modifiers == m_key2.modifiers && event.detail == m_key2.key) {
+                m_first_paint.start();
                 start();
             } else if (modifiers == m_key3.modifiers && event.detail == m_key3.key) {
+                m_first_paint.start();
                 gifStart();
             }
         }
@@ -107,7 +204,18 @@ bool MainWindow::nativeEventFilter(const QByteArray &eventType, void *message, l
 void MainWindow::mousePressEvent(QMouseEvent *event) {
     m_mouse_pos = event->pos();
 #ifdef Q_OS_LINUX
-    if (m_grab_mouse) {
+    if (! m_pending_screens.isEmpty()) {
+        // 窗口还没覆盖这块屏幕，靠抓取鼠标收到点击，先把这块屏幕截取下来
+        const QPoint native = m_mouse_pos * m_ratio;
+        const QVector<QRect> pending = m_pending_screens;
+        for (auto iter = pending.cbegin(); iter != pending.cend(); ++iter) {
+            if (iter->contains(native)) {
+                captureScreen(*iter);
+            }
+        }
+    }
+    // 还有屏幕没截取时继续抓取鼠标，全部截取后在 setScreen 中释放
+    if (m_grab_mouse && m_pending_screens.isEmpty()) {
         this->releaseMouse();
         m_grab_mouse = false;
     }
@@ -249,10 +357,10 @@ void MainWindow::mouseMoveEvent(QMouseEvent *event) {
     m_mouse_pos = event->pos();
     if (m_state == State::RectScreen && (event->buttons() & Qt::LeftButton)) {
         m_rect = getRect(m_point, event->pos());
-        update();
+        updateOverlay();
     } else if (m_state == State::FreeScreen && (event->buttons() & Qt::RightButton)) {
         m_path.lineTo(event->pos());
-        update();
+        updateOverlay();
     } else if ((m_state & State::Edit) && (event->buttons() & Qt::LeftButton)) {
         if (m_resize != ResizeImage::NoResize) {
             QPoint point = event->pos();
@@ -294,7 +402,7 @@ void MainWindow::mouseMoveEvent(QMouseEvent *event) {
                     m_rect.setRight(point.x());
                 }
             }
-            update();
+            updateOverlay();
         } else if (m_cursor == Qt::SizeAllCursor) {
             if (m_move_shape) {
                 m_move_shape->movePoint(m_mouse_pos);
@@ -320,7 +428,7 @@ void MainWindow::mouseMoveEvent(QMouseEvent *event) {
                     (*iter)->translate(point);
                 }
             }
-            update();
+            updateOverlay();
         } else if (m_cursor == Qt::BitmapCursor) {
             QRect &&rect = getGeometry();
             if (m_shape != nullptr && rect.isValid()) {
@@ -341,21 +449,17 @@ void MainWindow::mouseMoveEvent(QMouseEvent *event) {
                     m_shape->addPoint(point);
                 }
             }
-            update();
+            updateOverlay();
         }
     } else if (event->buttons() == Qt::NoButton) {
         QPoint point = event->pos();
         if (m_state == State::Null) {
             setCursorShape(Qt::CrossCursor);
-            for (int i = 0; i < m_windows.size(); ++i) {
-                if (m_windows[i].contains(event->pos())) {
-                    if (i != m_index) {
-                        m_index = i;
-                    }
-                    break;
-                }
+            int index = m_window_index.find(event->pos());
+            if (index != -1) {
+                m_index = index;
             }
-            update();
+            updateOverlay();
         } else if (m_state == State::RectEdit) {
             m_resize = ResizeImage::NoResize;
             if (m_rect.contains(point)) {
@@ -444,13 +548,13 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
             break;
         case Qt::Key_Right:
             if (m_state & State::Free) {
-                if (m_path.boundingRect().right() * m_ratio < m_image.width()) {
+                if (m_path.boundingRect().right() * m_ratio < m_desktop.width()) {
                     m_path.translate(1, 0);
                     update();
                     showTool();
                 }
             } else if (m_state & State::Rect) {
-                if (m_rect.right() * m_ratio < m_image.width()) {
+                if (m_rect.right() * m_ratio < m_desktop.width()) {
                     m_rect.translate(1, 0);
                     update();
                     showTool();
@@ -474,50 +578,79 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
             break;
         case Qt::Key_Down:
             if (m_state & State::Free) {
-                if (m_path.boundingRect().bottom() * m_ratio < m_image.height()) {
+                if (m_path.boundingRect().bottom() * m_ratio < m_desktop.height()) {
                     m_path.translate(0, 1);
                     update();
                     showTool();
                 }
             } else if (m_state & State::Rect) {
-                if (m_rect.bottom() * m_ratio < m_image.height()) {
+                if (m_rect.bottom() * m_ratio < m_desktop.height()) {
                     m_rect.translate(0, 1);
                     update();
                     showTool();
                 }
             }
             break;
+        case Qt::Key_W:
+            watchRegion();
+            break;
+        case Qt::Key_T:
+            timelapseRegion();
+            break;
+        case Qt::Key_A:
+            addBatch();
+            break;
+        case Qt::Key_B:
+            saveBatch();
+            break;
         }
     }
 }
 
 void MainWindow::paintEvent(QPaintEvent *event) {
     BaseWindow::paintEvent(event);
-    if (m_image.isNull() || m_gray_image.isNull()) {
+    waitDim();
+    if (m_desktop.isNull() || (m_gray_image.isNull() && ! m_paint_dim)) {
         m_tool->hide();
-        this->hide();
         return;
     }
     QRect rect;
     QPainter painter(this);
     painter.setPen(QPen(Qt::red, 2));
-    painter.drawImage(geometry(), m_gray_image);
+    // 只重绘需要更新的区域，鼠标移动时只有选区和放大镜附近需要重绘
+    const QRegion &dirty = event->region();
+    for (auto iter = dirty.begin(); iter != dirty.end(); ++iter) {
+        const QRect &target = *iter;
+        QRectF source{QPointF(target.topLeft()) * m_ratio, QSizeF(target.size()) * m_ratio};
+        if (m_paint_dim) {
+            // 黑色 60% 不透明度叠加后亮度为原来的 0.4，与 m_gray_image 一致
+            m_desktop.draw(painter, target, source);
+            painter.fillRect(target, QColor(0, 0, 0, 153));
+        } else {
+            m_gray_image.draw(painter, target, source);
+        }
+    }
+    // 已经加入批量截图的区域保持原样显示并标上序号
+    for (int i = 0; i < m_batch_rects.size(); ++i) {
+        const QRect &rect = m_batch_rects[i];
+        m_desktop.draw(painter, rect, QRectF(QPointF(rect.topLeft()) * m_ratio, QSizeF(rect.size()) * m_ratio));
+        painter.drawRect(rect.adjusted(- 1, - 1, 1, 1));
+        painter.drawText(rect.adjusted(4, 2, 0, 0), Qt::AlignLeft | Qt::AlignTop, QString::number(i + 1));
+    }
     if (m_state & State::Free) {
         rect = m_path.boundingRect().toRect();
         painter.drawPath(m_path);
-        QBrush brush{m_image};
-        QTransform transform;
-        transform.scale(1.0 / m_ratio, 1.0 / m_ratio);
-        brush.setTransform(transform);
-        painter.fillPath(m_path, brush);
+        // 直接从各屏幕的分块绘制，不生成整张纹理
+        const QRectF bounding = m_path.boundingRect();
         painter.setClipPath(m_path);
+        m_desktop.draw(painter, bounding, QRectF(bounding.topLeft() * m_ratio, bounding.size() * m_ratio));
     } else if (m_state & State::Rect) {
         rect = m_rect;
         QRectF sourceRect = QRectF(rect.left() * m_ratio,
                                    rect.top() * m_ratio,
                                    rect.width() * m_ratio,
                                    rect.height() * m_ratio);
-        painter.drawImage(rect, m_image, sourceRect);
+        m_desktop.draw(painter, rect, sourceRect);
         painter.drawRect(rect.adjusted(- 1, - 1, 1, 1));
         painter.setClipRect(rect);
     } else {
@@ -527,7 +660,7 @@ void MainWindow::paintEvent(QPaintEvent *event) {
                                        rect.top() * m_ratio,
                                        rect.width() * m_ratio,
                                        rect.height() * m_ratio);
-            painter.drawImage(rect, m_image, sourceRect);
+            m_desktop.draw(painter, rect, sourceRect);
             painter.drawRect(rect);
             painter.setClipRect(rect);
         }
@@ -543,23 +676,13 @@ void MainWindow::paintEvent(QPaintEvent *event) {
     if (m_state == State::Null || (m_state & State::Screen) || (m_press && m_resize != ResizeImage::NoResize)) {
         const QPoint &cursor = m_mouse_pos;
         if (cursor.x() >= 0 && cursor.y() >= 0) {
-            QPoint point;
-            if (cursor.x() + 85 + 10 <= this->width()) {
-                point.setX(cursor.x() + 10);
-            } else {
-                point.setX(cursor.x() - 85 - 10);
-            }
-            if (cursor.y() + 140 + 25 <= this->height()) {
-                point.setY(cursor.y() + 25);
-            } else {
-                point.setY(cursor.y() - 140 - 20);
-            }
+            QPoint point = magnifierRect(cursor).topLeft() + QPoint(3, 3);
             painter.fillRect(point.x() - 3, point.y() - 3 ,90, 145, QColor(0, 0, 0, 150));
             painter.drawRect(point.x() - 1, point.y() - 1, 84 + 2, 84 + 2);
-            painter.drawImage(QRect(point.x(), point.y(), 84, 84), m_image, QRect((cursor.x() - 10) * m_ratio, (cursor.y() - 10) * m_ratio, 21 * m_ratio, 21 * m_ratio));
+            m_desktop.draw(painter, QRect(point.x(), point.y(), 84, 84), QRect((cursor.x() - 10) * m_ratio, (cursor.y() - 10) * m_ratio, 21 * m_ratio, 21 * m_ratio));
             painter.drawLine(point.x(), point.y() + 42, point.x() + 84, point.y() + 42);
             painter.drawLine(point.x() + 42, point.y(), point.x() + 42, point.y() + 84);
-            QColor color = m_image.pixelColor(cursor * m_ratio);
+            QColor color = m_desktop.pixelColor(cursor * m_ratio);
             QFont font = painter.font();
             font.setPixelSize(13);
             painter.setFont(font);
@@ -571,6 +694,24 @@ void MainWindow::paintEvent(QPaintEvent *event) {
     }
 
     drawTips(painter);
+    m_overlay = overlayRegion();
+
+    if (m_first_paint.isValid()) {
+        QStringList stages;
+        for (auto iter = m_stages.cbegin(); iter != m_stages.cend(); ++iter) {
+            stages << QString("%1 %2ms").arg(iter->name).arg(iter->nsecs / 1e6, 0, 'f', 2);
+        }
+        qDebug().noquote() << QString("首帧(%1): %2ms, 本次内存峰值: %3KB, 各阶段: %4")
+                                  .arg(m_paint_dim ? "绘制时遮罩" : "预生成遮罩")
+                                  .arg(m_first_paint.nsecsElapsed() / 1e6, 0, 'f', 2)
+                                  .arg(sessionRss())
+                                  .arg(stages.join(", "));
+        m_first_paint.invalidate();
+    }
+    // 首帧显示后再截取其他屏幕
+    if (! m_pending_screens.isEmpty() && ! m_capture_scheduled) {
+        captureRemaining();
+    }
 }
 
 void MainWindow::closeEvent(QCloseEvent *event) {
@@ -584,16 +725,18 @@ bool MainWindow::nativeEvent(const QByteArray &eventType, void *message, qintptr
 #else
 bool MainWindow::nativeEvent(const QByteArray &eventType, void *message, long *result) {
 #endif // QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    if (! this->isVisible() && eventType == "windows_generic_MSG") {
+    if (! m_session && eventType == "windows_generic_MSG") {
         MSG *msg = reinterpret_cast<MSG*>(message);
         if (msg->message == WM_HOTKEY) {
             if (msg->wParam == 1) {
                 saveImage();
                 return true;
             } else if (msg->wParam == 2) {
+                m_first_paint.start();
                 start();
                 return true;
             } else if (msg->wParam == 3) {
+                m_first_paint.start();
                 gifStart();
                 return true;
             }
@@ -620,11 +763,28 @@ void MainWindow::saveImage() {
         return;
     }
 
+    m_saver->setLimit(m_setting->saveLimit());
+    if (m_saver->isFull()) {
+        qWarning() << "正在保存的截图过多，取消截图";
+        m_tray->showMessage("截图失败", "正在保存的截图过多，请稍后再试", QSystemTrayIcon::Warning, 3000);
+        return;
+    }
+
+    // 交给后台线程保存，不能使用与截图界面共用数据的 grabDesktop
+    CaptureEngine *engine = CaptureEngine::instance();
+    const QRect desktop{QPoint{0, 0}, engine->desktopSize()};
     QString windowTitle{"unknown"};
     QImage image;
+    // 截图区域左上角的物理像素坐标
+    QPoint origin;
     if (m_setting->fullScreen()) {
         windowTitle = "全屏";
-        image = fullScreenshot();
+#ifdef Q_OS_LINUX
+        image = engine->takeStandby(standbyMaxAge);
+#endif // Q_OS_LINUX
+        if (image.isNull()) {
+            image = engine->grabRegion(desktop, QImage::Format_RGB32);
+        }
     } else {
         QRect rect;
 #if defined(Q_OS_WINDOWS)
@@ -655,6 +815,7 @@ void MainWindow::saveImage() {
             return;
         }
         Window rootWindow = DefaultRootWindow(display);
+        Window target = None;
 
         Atom actual_type;
         int actual_format;
@@ -673,6 +834,7 @@ void MainWindow::saveImage() {
                 if ((attributes.map_state == IsViewable) && (attributes.width != attributes.height || attributes.width > 5 || attributes.height > 5)) {
                     rect = {attributes.x, attributes.y, attributes.width, attributes.height};
                     windowTitle = getWindowTitle(display, active_window);
+                    target = active_window;
                 }
             }
         }
@@ -690,52 +852,49 @@ void MainWindow::saveImage() {
                     }
                     rect = {attributes.x, attributes.y, attributes.width, attributes.height};
                     windowTitle = getWindowTitle(display, children[i]);
+                    target = children[i];
                     break;
                 }
 
                 XFree(children);
             }
         }
-#endif // Q_OS_LINUX
-        QList<QScreen*> list = QApplication::screens();
-        for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-            QRect r = (*iter)->geometry();
-            r.setWidth(r.width() * (*iter)->devicePixelRatio());
-            r.setHeight(r.height() * (*iter)->devicePixelRatio());
-            if (r.contains(rect, false)) {
-                QScreen *screen = (*iter);
-                image = screen->grabWindow(0, rect.x(), rect.y(), rect.width(), rect.height()).toImage();
-                break;
-            }
+        // 直接读取窗口内容失败（没有合成器等）时按屏幕坐标裁剪
+        if (target != None && m_setting->windowCapture()) {
+            image = engine->grabWindow(target);
         }
-
+#endif // Q_OS_LINUX
         if (image.isNull()) {
-            image = fullScreenshot().copy(rect);
+            image = engine->grabRegion(rect.isEmpty() ? desktop : rect, QImage::Format_RGB32);
         }
+        origin = rect.isEmpty() ? desktop.topLeft() : rect.topLeft();
     }
     if (image.isNull()) {
         qWarning() << "图片为空";
         m_tray->showMessage("截图失败", "截图失败", QSystemTrayIcon::Critical, 3000);
     } else {
+#ifdef Q_OS_LINUX
+        m_export->publish(DesktopImage{image}, image.rect(), origin);
+#endif // Q_OS_LINUX
         static QRegularExpression regex(R"([\/:*?"<>|])");
         windowTitle.replace(regex, "_");
-        std::string saveFormat = m_setting->saveFormat().toStdString();
-        const char *format = saveFormat.c_str();
-        QString datetimeString = QDateTime::currentDateTime().toString("yyyy-MM-dd-hh-mm-ss.zzz");
-        QString imagePath = QString("%1%2%3_%4.%5").arg(path, QDir::separator(), windowTitle, datetimeString, format);
-        bool ret = image.save(imagePath, format);
-        if (! ret) {
-            imagePath = QString("%1%2%3.%4").arg(path, QDir::separator(), datetimeString, format);
-            ret = image.save(imagePath, format);
-        }
-        if (ret) {
-            m_tray->showMessage("截图成功", QString("图片已保存到%1").arg(imagePath), QIcon(QPixmap::fromImage(image)), 3000);
-        } else {
-            m_tray->showMessage("截图失败", QString("保存图片到%1失败").arg(imagePath), QSystemTrayIcon::Critical, 3000);
+        if (! m_saver->save(image, path, windowTitle, m_setting->saveFormat())) {
+            m_tray->showMessage("截图失败", "正在保存的截图过多，请稍后再试", QSystemTrayIcon::Warning, 3000);
         }
     }
 }
 
+void MainWindow::imageSaved(bool success, const QString &path, const QImage &thumbnail) {
+    if (success && thumbnail.isNull()) {
+        // 定时截图不逐张提示
+        return;
+    } else if (success) {
+        m_tray->showMessage("截图成功", QString("图片已保存到%1").arg(path), QIcon(QPixmap::fromImage(thumbnail)), 3000);
+    } else {
+        m_tray->showMessage("截图失败", QString("保存图片到%1失败").arg(path), QSystemTrayIcon::Critical, 3000);
+    }
+}
+
 void MainWindow::start() {
     m_ratio = 1;
     m_mouse_pos = QCursor::pos();
@@ -746,40 +905,146 @@ void MainWindow::start() {
     } else {
         connect(this, SIGNAL(choosePath()), m_tool, SLOT(choosePath()), static_cast<Qt::ConnectionType>(Qt::AutoConnection | Qt::UniqueConnection));
     }
-    setWindowFlags(Qt::FramelessWindowHint | Qt::WindowStaysOnTopHint | Qt::Tool);
-    m_image = fullScreenshot();
-    m_gray_image = QImage(m_image.size(), QImage::Format_ARGB32);
-    for (int x = 0; x < m_image.width(); ++x) {
-        for (int y = 0; y < m_image.height(); ++y) {
-            QRgb rgb = m_image.pixel(x, y);
-            int r = 0.4 * qRed(rgb);
-            int g = 0.4 * qGreen(rgb);
-            int b = 0.4 * qBlue(rgb);
-            m_gray_image.setPixel(x, y, qRgb(r, g, b));
-        }
+    // 热键触发时已经开始计时
+    if (! m_first_paint.isValid()) {
+        m_first_paint.start();
     }
+    resetPeakRss();
+    m_session = true;
+    waitDim();
+    m_stages.clear();
+    m_stages.push_back({"热键到开始", m_first_paint.nsecsElapsed()});
+    QElapsedTimer timer;
+    timer.start();
+    // 窗口列表、截图和遮罩互不依赖，窗口列表先在后台查询
+    m_ratio = CaptureEngine::instance()->ratio();
     updateWindows();
+    m_stages.push_back({"启动窗口查询", timer.nsecsElapsed()});
+    timer.restart();
+    m_pending_screens.clear();
+    m_recalled = ! m_recall.isNull();
+    if (m_recalled) {
+        // 从截图历史打开，不重新截图
+        m_desktop = std::move(m_recall);
+        m_recall.clear();
+    } else if (m_setting->progressive()) {
+#ifdef Q_OS_LINUX
+        CaptureEngine::instance()->discardStandby();
+#endif // Q_OS_LINUX
+        m_desktop = progressiveScreenshot();
+    } else {
+        m_desktop = fullScreenshot();
+    }
+    m_stages.push_back({"截图", timer.nsecsElapsed()});
+    qDebug() << CaptureEngine::instance()->statsString();
+    m_paint_dim = m_setting->paintDim();
+    if (! m_paint_dim) {
+        startDim();
+    }
+    timer.restart();
+    // 窗口标志只在构造时设置一次，结束截图时窗口停在屏幕外，不会取消映射
     setWindowState((windowState() & ~(Qt::WindowMinimized | Qt::WindowMaximized)) | Qt::WindowFullScreen);
-    setFixedSize(m_image.size() / m_ratio);
-    setGeometry(0, 0, m_image.width() / m_ratio, m_image.height() / m_ratio);
+    setFixedSize(m_desktop.size() / m_ratio);
+    setGeometry(0, 0, m_desktop.width() / m_ratio, m_desktop.height() / m_ratio);
+    setWindowOpacity(1);
     setCursorShape(Qt::CrossCursor);
-    setVisible(true);
+    if (m_pending_screens.isEmpty()) {
+        clearMask();
+    } else {
+        setMask(m_captured);
+    }
+    if (isVisible()) {
+        raise();
+    } else {
+#ifdef Q_OS_LINUX
+        bypassCompositor();
+#endif // Q_OS_LINUX
+        setVisible(true);
+    }
     m_state = State::Null;
     m_resize = ResizeImage::NoResize;
     m_path.clear();
     m_press = false;
     activateWindow();
+    m_stages.push_back({"窗口配置", timer.nsecsElapsed()});
     update();
     emit started();
 }
 
+void MainWindow::startDim() {
+    // 后台线程只读 m_desktop、只写 m_gray_image，主线程在 waitDim 之前不访问 m_gray_image
+    m_dim_thread = std::thread{[this]() {
+        QElapsedTimer timer;
+        timer.start();
+        // 按 m_desktop 的分块分别处理
+        DesktopImage gray{m_desktop.size()};
+        for (auto iter = m_desktop.frames().cbegin(); iter != m_desktop.frames().cend(); ++iter) {
+            QImage image = CaptureEngine::instance()->acquire(iter->image.size(), QImage::Format_ARGB32, ImagePool::Overlay);
+            dimImage(iter->image, image);
+            gray.addFrame(iter->rect, image);
+        }
+        m_gray_image = std::move(gray);
+        m_dim_nsecs = timer.nsecsElapsed();
+    }};
+}
+
+void MainWindow::waitDim() {
+    if (! m_dim_thread.joinable()) return;
+    QElapsedTimer timer;
+    timer.start();
+    m_dim_thread.join();
+    if (m_session) {
+        m_stages.push_back({"遮罩(后台)", m_dim_nsecs});
+        m_stages.push_back({"等待遮罩", timer.nsecsElapsed()});
+    }
+}
+
+QRect MainWindow::magnifierRect(const QPoint &cursor) const {
+    QPoint point;
+    if (cursor.x() + 85 + 10 <= this->width()) {
+        point.setX(cursor.x() + 10);
+    } else {
+        point.setX(cursor.x() - 85 - 10);
+    }
+    if (cursor.y() + 140 + 25 <= this->height()) {
+        point.setY(cursor.y() + 25);
+    } else {
+        point.setY(cursor.y() - 140 - 20);
+    }
+    return {point.x() - 3, point.y() - 3, 90, 145};
+}
+
+QRegion MainWindow::overlayRegion() const {
+    // 边框画笔宽度为 2，形状都裁剪在选区内，包含在选区范围里
+    QRegion region;
+    if (m_state & State::Free) {
+        region += m_path.boundingRect().toAlignedRect().adjusted(-2, -2, 2, 2);
+    } else if (m_state & State::Rect) {
+        region += m_rect.adjusted(-3, -3, 3, 3);
+    } else if (m_index >= 0 && m_index < m_windows.size()) {
+        region += m_windows[m_index].adjusted(-2, -2, 2, 2);
+    }
+    if (m_state == State::Null || (m_state & State::Screen) || (m_press && m_resize != ResizeImage::NoResize)) {
+        if (m_mouse_pos.x() >= 0 && m_mouse_pos.y() >= 0) {
+            // 文字可能超出背景框
+            region += magnifierRect(m_mouse_pos).adjusted(-2, -2, 40, 4);
+        }
+    }
+    return region;
+}
+
+void MainWindow::updateOverlay() {
+    // 上次绘制的位置和当前位置都需要重绘
+    update(m_overlay + overlayRegion());
+}
+
 void MainWindow::gifStart() {
     m_gif = true;
     start();
 }
 
 void MainWindow::showTool() {
-    if (! this->isVisible()) return;
+    if (! m_session) return;
     QPoint point;
     const QRect &rect = getGeometry();
 
@@ -834,7 +1099,7 @@ QRect MainWindow::getGeometry() const {
 
 #ifdef Q_OS_LINUX
 void MainWindow::keyPress(int code, Qt::KeyboardModifiers modifiers) {
-    if (! this->isVisible()) {
+    if (! m_session) {
         static const std::unordered_map<int, char> xEventcodeToChar = {
             {24, 'Q'}, {25, 'W'}, {26, 'E'}, {27, 'R'}, {28, 'T'}, {29, 'Y'}, {30, 'U'},
             {31, 'I'}, {32, 'O'}, {33, 'P'}, {38, 'A'}, {39, 'S'}, {40, 'D'}, {41, 'F'},
@@ -869,6 +1134,24 @@ void MainWindow::grabMouseEvent() {
     this->grabMouse();
     m_grab_mouse = true;
 }
+
+void MainWindow::modifiersChanged(Qt::KeyboardModifiers modifiers) {
+    if (! m_setting->speculative() || m_session) return;
+    quint32 mods = 0;
+    if (modifiers & Qt::ShiftModifier)
+        mods |= ShiftMask;
+    if (modifiers & Qt::ControlModifier)
+        mods |= ControlMask;
+    if (modifiers & Qt::AltModifier)
+        mods |= Mod1Mask;
+    // 修饰键与某个热键一致时先截图，松开或者换成其他组合时丢弃
+    CaptureEngine *engine = CaptureEngine::instance();
+    if (mods != 0 && (mods == m_key1.modifiers || mods == m_key2.modifiers || mods == m_key3.modifiers)) {
+        engine->prepareStandby();
+    } else {
+        engine->discardStandby();
+    }
+}
 #endif // Q_OS_LINUX
 
 #ifdef OCR
@@ -893,7 +1176,8 @@ void MainWindow::onQrCode() {
 void MainWindow::longScreenshot() {
     if (m_state & State::Rect) {
         if (m_rect.width() <= 0 || m_rect.height() <= 0) return;
-        QImage image = m_image.copy(m_rect.left() * m_ratio, m_rect.top() * m_ratio, m_rect.width() * m_ratio, m_rect.height() * m_ratio);
+        captureSelection();
+        QImage image = m_desktop.copy(m_rect.left() * m_ratio, m_rect.top() * m_ratio, m_rect.width() * m_ratio, m_rect.height() * m_ratio);
         auto *l = new LongWidget(image, m_rect, size(), m_menu, m_ratio);
         connect(this, &MainWindow::mouseWheeled, l, &LongWidget::mouseWheel);
         end();
@@ -1091,38 +1375,9 @@ void MainWindow::save(const QString &path) {
             new GifWidget{size(), m_rect, m_menu, m_ratio};
         }
     } else {
-        QImage image;
-        QPainter painter;
-        if (m_state & State::Free) {
-            QRect rect = m_path.boundingRect().toRect();
-            if (rect.width() <= 0 || rect.height() <= 0) return;
-            image = QImage(rect.size() * m_ratio, QImage::Format_ARGB32);
-            painter.begin(&image);
-            painter.fillRect(image.rect(), QColor(0, 0, 0, 0));
-            painter.translate(- rect.topLeft() * m_ratio);
-            QTransform transform;
-            transform.scale(m_ratio, m_ratio);
-            QPainterPath painterPath = transform.map(m_path);
-            painter.fillPath(painterPath, m_image);
-            painter.setClipPath(painterPath);
-        } else if (m_state & State::Rect) {
-            if (m_rect.width() <= 0 || m_rect.height() <= 0) return;
-            image = m_image.copy(m_rect.left() * m_ratio, m_rect.top() * m_ratio, m_rect.width() * m_ratio, m_rect.height() * m_ratio);
-            painter.begin(&image);
-            painter.translate(- m_rect.topLeft() * m_ratio);
-        } else {
-            return;
-        }
-        if (! m_vector.empty() || (m_shape != nullptr && ! m_shape->isNull())) {
-            for (auto iter = m_vector.begin(); iter != m_vector.end(); ++iter) {
-                (*iter)->scale(m_ratio, m_ratio);
-                (*iter)->draw(painter);
-            }
-            if (m_shape != nullptr && ! m_shape->isNull()) {
-                m_shape->draw(painter);
-            }
-        }
-        painter.end();
+        const QImage image = renderSelection();
+        if (image.isNull()) return;
+        publishSelection();
         if (path.length() == 0) {
             QClipboard *clipboard = QApplication::clipboard();
             if (clipboard) {
@@ -1136,20 +1391,164 @@ void MainWindow::save(const QString &path) {
     end();
 }
 
+QImage MainWindow::renderSelection() {
+    captureSelection();
+    QImage image;
+    QPainter painter;
+    if (m_state & State::Free) {
+        QRect rect = m_path.boundingRect().toRect();
+        if (rect.width() <= 0 || rect.height() <= 0) return QImage();
+        image = QImage(rect.size() * m_ratio, QImage::Format_ARGB32);
+        painter.begin(&image);
+        painter.fillRect(image.rect(), QColor(0, 0, 0, 0));
+        painter.translate(- rect.topLeft() * m_ratio);
+        QTransform transform;
+        transform.scale(m_ratio, m_ratio);
+        QPainterPath painterPath = transform.map(m_path);
+        painter.fillPath(painterPath, m_desktop.brush(painterPath.boundingRect().toAlignedRect()));
+        painter.setClipPath(painterPath);
+    } else if (m_state & State::Rect) {
+        if (m_rect.width() <= 0 || m_rect.height() <= 0) return QImage();
+        image = m_desktop.copy(m_rect.left() * m_ratio, m_rect.top() * m_ratio, m_rect.width() * m_ratio, m_rect.height() * m_ratio);
+        painter.begin(&image);
+        painter.translate(- m_rect.topLeft() * m_ratio);
+    } else {
+        return QImage();
+    }
+    // 形状按 m_ratio 放大后绘制，调用后形状不能再用于窗口绘制
+    if (! m_vector.empty() || (m_shape != nullptr && ! m_shape->isNull())) {
+        for (auto iter = m_vector.begin(); iter != m_vector.end(); ++iter) {
+            (*iter)->scale(m_ratio, m_ratio);
+            (*iter)->draw(painter);
+        }
+        if (m_shape != nullptr && ! m_shape->isNull()) {
+            m_shape->draw(painter);
+        }
+    }
+    painter.end();
+    return image;
+}
+
+void MainWindow::addBatch() {
+    if (m_gif) return;
+    const QRect rect = (m_state & State::Free) ? m_path.boundingRect().toAlignedRect() : m_rect;
+    // 立即从本次的桌面截图裁剪，不重新截图
+    const QImage image = renderSelection();
+    if (image.isNull()) return;
+    m_batch.append(image);
+    m_batch_rects.append(rect);
+    // 回到未选择状态，继续选择下一块区域
+    clearDraw();
+    m_state = State::Null;
+    m_resize = ResizeImage::NoResize;
+    m_path.clear();
+    m_rect = QRect{};
+    m_tool->hide();
+    addTip(QString("已添加%1块区域，按B全部保存").arg(m_batch.size()));
+    update();
+}
+
+void MainWindow::saveBatch() {
+    if (m_gif) return;
+    if (m_state & (State::Free | State::Rect)) {
+        addBatch();
+    }
+    if (m_batch.isEmpty()) return;
+    const QString path = m_setting->autoSavePath();
+    if (path.isEmpty() || ! QDir{path}.mkpath(path)) {
+        addTip("未设置自动保存路径");
+        return;
+    }
+    // 各区域交给保存线程池并行编码，整批入队，不占用也不修改单张截图的保存上限
+    const int saved = m_saver->saveBatch(m_batch, path, "批量截图", m_setting->saveFormat());
+#ifdef Q_OS_LINUX
+    for (int i = 0; i < m_batch.size(); ++i) {
+        m_export->publish(DesktopImage{m_batch[i]}, m_batch[i].rect(), m_batch_rects[i].topLeft() * m_ratio);
+    }
+#endif // Q_OS_LINUX
+    m_tray->showMessage("批量截图", QString("%1块区域保存到%2").arg(saved).arg(path), QSystemTrayIcon::Information, 3000);
+    end();
+}
+
+QRect MainWindow::selectionRect() const {
+    QRect selection;
+    if (m_state & State::Free) {
+        const QRectF bounding = m_path.boundingRect();
+        selection = QRectF{bounding.topLeft() * m_ratio, bounding.size() * m_ratio}.toAlignedRect();
+    } else if (m_state & State::Rect) {
+        selection = QRect{m_rect.topLeft() * m_ratio, m_rect.size() * m_ratio};
+    }
+    return selection.intersected(m_desktop.rect());
+}
+
+void MainWindow::publishSelection() {
+#ifdef Q_OS_LINUX
+    const QRect selection = selectionRect();
+    if (! m_gif && ! selection.isEmpty()) {
+        m_export->publish(m_desktop, selection);
+    }
+#endif // Q_OS_LINUX
+}
+
 void MainWindow::end() {
+    waitDim();
+    // 完整截取的桌面交给截图历史，在后台压缩
+    if (! m_gif && ! m_recalled && m_pending_screens.isEmpty() && ! m_desktop.isNull()) {
+        m_history->setLimit(m_setting->historyCount(), static_cast<qint64>(m_setting->historyMemory()) * 1024 * 1024);
+        m_history->add(m_desktop, selectionRect(), m_ratio);
+    }
+    m_recalled = false;
+    m_batch.clear();
+    m_batch_rects.clear();
     m_state = State::Null;
     m_resize = ResizeImage::NoResize;
     m_path.clear();
-    m_image = m_gray_image = QImage();
+    m_desktop.clear();
+    m_gray_image.clear();
+    m_overlay = QRegion();
     m_gif = false;
+    m_session = false;
+    m_first_paint.invalidate();
+    m_pending_screens.clear();
+    m_captured = QRegion();
+    m_capture_scheduled = false;
+    ++m_screen_serial;
+    clearMask();
+#ifdef Q_OS_LINUX
+    // 窗口不再隐藏，需要手动释放
+    if (m_grab_mouse) {
+        this->releaseMouse();
+        m_grab_mouse = false;
+    }
+#endif // Q_OS_LINUX
     clearDraw();
     safeDelete(m_shape);
-    resize(1, 1);
+    m_tool->hide();
+    // 不隐藏窗口，缩小后移到屏幕外，下次截图时省去映射和窗口管理器重新布置的时间
+    setWindowState(windowState() & ~Qt::WindowFullScreen);
+    setFixedSize(1, 1);
+    // 屏幕坐标可能是负数，按虚拟桌面计算；窗口管理器仍可能把窗口挪回屏幕内，所以同时设为完全透明
+    const QRect virtualDesktop = QGuiApplication::primaryScreen()->virtualGeometry();
+    move(virtualDesktop.left() - parkOffset, virtualDesktop.top() - parkOffset);
+    setWindowOpacity(0);
     update();
     emit finished();
 }
 
+void MainWindow::saveColor() {
+    if (! m_desktop.isNull()) {
+        QClipboard *clipboard = QApplication::clipboard();
+        if (clipboard) {
+            clipboard->setText(m_desktop.pixelColor(m_mouse_pos * m_ratio).name().toUpper());
+            addTip("复制颜色成功");
+        } else {
+            addTip("复制颜色失败");
+        }
+    }
+}
+
 TopWidget *MainWindow::top() {
+    captureSelection();
     if (m_state & State::Free) {
         QRect rect = m_path.boundingRect().toRect();
         if (rect.width() <= 0 || rect.height() <= 0) return nullptr;
@@ -1157,16 +1556,20 @@ TopWidget *MainWindow::top() {
         for (auto iter = m_vector.cbegin(); iter != m_vector.cend(); ++iter) {
             (*iter)->translate(- point);
         }
-        QImage image = QImage(rect.size() * m_ratio, QImage::Format_ARGB32);
+        QImage image = CaptureEngine::instance()->acquire(rect.size() * m_ratio, QImage::Format_ARGB32, ImagePool::Pin);
         QPainter painter(&image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
         painter.fillRect(image.rect(), QColor(0, 0, 0, 0));
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
         painter.translate(- point * m_ratio);
         QTransform transform;
         transform.scale(m_ratio, m_ratio);
-        painter.fillPath(transform.map(m_path), m_image);
+        const QPainterPath painterPath = transform.map(m_path);
+        painter.fillPath(painterPath, m_desktop.brush(painterPath.boundingRect().toAlignedRect()));
         painter.end();
         auto *t = new TopWidget(image, m_path.translated(- point), m_vector, rect, m_menu, m_ratio);
         connectTopWidget(t);
+        publishSelection();
         end();
         return t;
     } else if (m_state & State::Rect) {
@@ -1176,9 +1579,15 @@ TopWidget *MainWindow::top() {
             (*iter)->translate(- point);
         }
 
-        QImage image = m_image.copy(m_rect.left() * m_ratio, m_rect.top() * m_ratio, m_rect.width() * m_ratio, m_rect.height() * m_ratio);
+        const QRect source{m_rect.topLeft() * m_ratio, m_rect.size() * m_ratio};
+        QImage image = CaptureEngine::instance()->acquire(source.size(), QImage::Format_RGB32, ImagePool::Pin);
+        m_desktop.copyTo(source, image);
         auto *t = new TopWidget(std::move(image), m_vector, m_rect, m_menu, m_ratio);
+#ifdef Q_OS_LINUX
+        t->setSource(CaptureEngine::instance()->toNativeRect(m_rect, m_ratio));
+#endif // Q_OS_LINUX
         connectTopWidget(t);
+        publishSelection();
         end();
         return t;
     }
@@ -1194,6 +1603,32 @@ void MainWindow::initTray() {
     m_action2->setToolTip("点击截图");
     m_action3 = m_menu->addAction(QIcon(":/images/gif.png"), "录制GIF(未设置)", this, &MainWindow::gifStart);
     m_action3->setToolTip("点击录制GIF");
+    m_watch_action = m_menu->addAction("停止监视区域", this, [this]() {
+        m_watcher->stop();
+        m_watch_action->setVisible(false);
+    });
+    m_watch_action->setVisible(false);
+    m_timelapse_action = m_menu->addAction("定时截图(全屏)", this, [this]() {
+        if (m_timelapse->isActive()) {
+            stopTimelapse();
+        } else {
+            startTimelapse({});
+        }
+    });
+    m_history_menu = m_menu->addMenu("截图历史");
+    connect(m_history_menu, &QMenu::aboutToShow, this, &MainWindow::updateHistoryMenu);
+    m_memory_action = m_menu->addAction("图片内存", this, &MainWindow::showMemory);
+    m_memory_action->setToolTip("点击查看各模块占用的图片内存");
+    connect(m_menu, &QMenu::aboutToShow, this, [this]() {
+        ImagePool *pool = ImagePool::instance();
+        qint64 bytes = pool->cached();
+        for (int i = 0; i < ImagePool::OwnerCount; ++i) {
+            bytes += pool->used(static_cast<ImagePool::Owner>(i));
+        }
+        m_memory_action->setText(QString("图片内存(%1MB)").arg(bytes / 1048576.0, 0, 'f', 1));
+        m_history->setLimit(m_setting->historyCount(), static_cast<qint64>(m_setting->historyMemory()) * 1024 * 1024);
+        m_history_menu->setTitle(QString("截图历史(%1张, %2MB)").arg(m_history->count()).arg(m_history->bytes() / 1048576.0, 0, 'f', 1));
+    });
     m_menu->addAction(QIcon(":/images/exit.png"), "退出", this, &MainWindow::quit);
     m_menu->addSeparator();
     m_tray = new QSystemTrayIcon(this);
@@ -1204,6 +1639,120 @@ void MainWindow::initTray() {
     connect(m_tray, &QSystemTrayIcon::messageClicked, this, &MainWindow::openSaveDir);
 }
 
+void MainWindow::watchRegion() {
+    if (! (m_state & State::Rect) || m_rect.width() <= 0 || m_rect.height() <= 0) return;
+    if (m_setting->autoSavePath().isEmpty()) {
+        addTip("未设置自动保存路径");
+        return;
+    }
+    const QRect native = CaptureEngine::instance()->toNativeRect(m_rect, m_ratio);
+    end();
+    m_watcher->setThreshold(m_setting->watchThreshold());
+    m_watcher->setBudget(m_setting->watchBudget());
+    m_watcher->start(native);
+    m_watch_action->setVisible(true);
+    m_tray->showMessage("区域监视", QString("开始监视区域，变化超过%1%时自动保存").arg(m_setting->watchThreshold()), QSystemTrayIcon::Information, 3000);
+}
+
+void MainWindow::timelapseRegion() {
+    if (! (m_state & State::Rect) || m_rect.width() <= 0 || m_rect.height() <= 0) return;
+    if (m_setting->autoSavePath().isEmpty()) {
+        addTip("未设置自动保存路径");
+        return;
+    }
+    const QRect native = CaptureEngine::instance()->toNativeRect(m_rect, m_ratio);
+    end();
+    startTimelapse(native);
+}
+
+void MainWindow::startTimelapse(const QRect &native) {
+    if (m_setting->autoSavePath().isEmpty()) {
+        m_tray->showMessage("路径错误", "未设置自动保存路径", QSystemTrayIcon::Warning, 3000);
+        return;
+    }
+    m_timelapse->start(native, m_setting->timelapseInterval());
+    m_timelapse_action->setText("停止定时截图");
+    m_tray->showMessage("定时截图", QString("每%1秒截图一次，内容没有变化时不保存").arg(m_setting->timelapseInterval()), QSystemTrayIcon::Information, 3000);
+}
+
+void MainWindow::stopTimelapse() {
+    const int captured = m_timelapse->captured();
+    const int skipped = m_timelapse->skipped();
+    m_timelapse->stop();
+    m_timelapse_action->setText("定时截图(全屏)");
+    m_tray->showMessage("定时截图", QString("已停止，保存%1张，跳过重复%2张").arg(captured).arg(skipped), QSystemTrayIcon::Information, 3000);
+}
+
+MainWindow::SaveResult MainWindow::saveFrame(const QImage &image, const QString &title, bool quiet) {
+    // 与 saveImage 使用相同的目录、命名和格式
+    const QString path = m_setting->autoSavePath();
+    if (path.isEmpty() || ! QDir{path}.mkpath(path)) {
+        qWarning() << "自动保存路径无效" << title;
+        return InvalidPath;
+    }
+    m_saver->setLimit(m_setting->saveLimit());
+    if (! m_saver->save(image, path, title, m_setting->saveFormat(), quiet)) {
+        qWarning() << "正在保存的截图过多，跳过这一张" << title;
+        return QueueFull;
+    }
+    return Saved;
+}
+
+void MainWindow::updateHistoryMenu() {
+    m_history_menu->clear();
+    const QVector<CaptureHistory::Entry> list = m_history->entries();
+    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
+        const quint64 id = iter->id;
+        QMenu *menu = m_history_menu->addMenu(QIcon(QPixmap::fromImage(iter->thumbnail)),
+                                              QString("%1 (%2x%3)").arg(iter->time.toString("hh:mm:ss")).arg(iter->size.width()).arg(iter->size.height()));
+        menu->addAction(iter->selection.isEmpty() ? "置顶整个桌面" : "置顶选区", this, [this, id]() { recallPin(id); });
+        menu->addAction("重新编辑", this, [this, id]() { recallEdit(id); });
+    }
+    if (list.isEmpty()) {
+        m_history_menu->addAction("没有截图")->setEnabled(false);
+    } else {
+        m_history_menu->addSeparator();
+        m_history_menu->addAction("清空", m_history, &CaptureHistory::clear);
+    }
+}
+
+void MainWindow::recallPin(quint64 id) {
+    const QVector<CaptureHistory::Entry> list = m_history->entries();
+    auto entry = list.cbegin();
+    while (entry != list.cend() && entry->id != id) {
+        ++entry;
+    }
+    if (entry == list.cend()) return;
+    const QImage image = m_history->restore(id);
+    if (image.isNull()) return;
+    const QRect source = entry->selection.isEmpty() ? image.rect() : entry->selection;
+    QImage pin = CaptureEngine::instance()->acquire(source.size(), QImage::Format_RGB32, ImagePool::Pin);
+    DesktopImage{image}.copyTo(source, pin);
+    QVector<Shape*> shapes;
+    const QRect rect{source.topLeft() / entry->ratio, source.size() / entry->ratio};
+    auto *t = new TopWidget(std::move(pin), shapes, rect, m_menu, entry->ratio);
+    connectTopWidget(t);
+}
+
+void MainWindow::recallEdit(quint64 id) {
+    if (m_session) return;
+    QImage image = m_history->restore(id);
+    if (image.isNull()) return;
+    if (image.size() != CaptureEngine::instance()->desktopSize()) {
+        m_tray->showMessage("截图历史", "屏幕布局已经改变，只能置顶", QSystemTrayIcon::Warning, 3000);
+        return;
+    }
+    m_recall = DesktopImage{image};
+    m_first_paint.start();
+    start();
+}
+
+void MainWindow::showMemory() {
+    const QString text = ImagePool::instance()->statsString();
+    qInfo().noquote() << "图片内存:" << text;
+    m_tray->showMessage("图片内存", text, QSystemTrayIcon::Information, 5000);
+}
+
 void MainWindow::openSaveDir() {
     QString path = m_setting->autoSavePath();
     if (path.isEmpty()) {
@@ -1250,22 +1799,63 @@ bool MainWindow::contains(const QPoint &point) {
 
 void MainWindow::updateWindows() {
     m_windows.clear();
+    m_window_index.clear();
     m_index = 0;
+    const quint64 serial = ++m_window_serial;
 
-#ifdef Q_OS_WINDOWS
-    HWND hwnd = GetTopWindow(nullptr);
-    QRect rect = getRectByHwnd(hwnd);
-    if (rect.isValid()) {
-        m_windows.push_back(QRect(rect.left() / m_ratio, rect.top() / m_ratio, rect.width() / m_ratio, rect.height() / m_ratio));
+    // 在后台线程查询，截图界面不用等待窗口列表
+    const qreal ratio = m_ratio;
+    // 截图界面和工具栏可能已经显示，不能出现在窗口列表里
+#if defined(Q_OS_WINDOWS)
+    const QVector<HWND> exclude{reinterpret_cast<HWND>(winId()), reinterpret_cast<HWND>(m_tool->winId())};
+#elif defined(Q_OS_LINUX)
+    const QVector<quint32> exclude{static_cast<quint32>(winId()), static_cast<quint32>(m_tool->winId())};
+#endif
+    if (m_window_thread.joinable()) {
+        m_window_thread.join();
     }
-
-    while ((hwnd = GetNextWindow(hwnd, GW_HWNDNEXT)) != nullptr) {
-        QRect tmp = getRectByHwnd(hwnd);
-        if (tmp.isValid()) {
-            m_windows.push_back(QRect(tmp.left() / m_ratio, tmp.top() / m_ratio, tmp.width() / m_ratio, tmp.height() / m_ratio));
+    m_window_thread = std::thread{[=, this]() {
+        QElapsedTimer timer;
+        timer.start();
+#if defined(Q_OS_WINDOWS)
+        QVector<QRect> windows;
+        for (HWND hwnd = GetTopWindow(nullptr); hwnd != nullptr; hwnd = GetNextWindow(hwnd, GW_HWNDNEXT)) {
+            if (exclude.contains(hwnd)) continue;
+            QRect rect = getRectByHwnd(hwnd);
+            if (rect.isValid()) {
+                windows.push_back(rect);
+            }
         }
-    }
 #elif defined(Q_OS_LINUX)
+        QVector<QRect> windows = WindowIndex::queryWindows(exclude);
+#else
+        QVector<QRect> windows;
+#endif
+        for (auto iter = windows.begin(); iter != windows.end(); ++iter) {
+            *iter = {static_cast<int>(iter->x() / ratio),
+                     static_cast<int>(iter->y() / ratio),
+                     static_cast<int>(iter->width() / ratio),
+                     static_cast<int>(iter->height() / ratio)};
+        }
+        qDebug() << QString("窗口列表: %1个, %2ms").arg(windows.size()).arg(timer.nsecsElapsed() / 1e6, 0, 'f', 2);
+        QMetaObject::invokeMethod(this, [this, serial, windows]() {
+            setWindows(serial, windows);
+        }, Qt::QueuedConnection);
+    }};
+}
+
+void MainWindow::setWindows(quint64 serial, const QVector<QRect> &windows) {
+    // 已经开始了新的截图或者截图已经结束
+    if (serial != m_window_serial || m_desktop.isNull()) return;
+    m_windows = windows;
+    m_window_index.reset(m_windows);
+    int index = m_window_index.find(m_mouse_pos);
+    m_index = index == -1 ? 0 : index;
+    updateOverlay();
+}
+
+#ifdef Q_OS_LINUX
+void MainWindow::bypassCompositor() {
     Display *display = nullptr;
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
     if (auto *x11Application = qGuiApp->nativeInterface<QNativeInterface::QX11Application>()) {
@@ -1274,74 +1864,155 @@ void MainWindow::updateWindows() {
 #else
     display = QX11Info::display();
 #endif // #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
-    if (! display) {
-        qWarning() << "未获取到display";
-        return;
-    }
-    Window rootWindow = DefaultRootWindow(display);
-    Window parent;
-    Window* children;
-    unsigned int nChildren;
-    // 获取所有子窗口
-    if (XQueryTree(display, rootWindow, &rootWindow, &parent, &children, &nChildren)) {
-        for (int i = nChildren - 1; i >= 0; --i) {
-            XWindowAttributes attributes;
-            XGetWindowAttributes(display, children[i], &attributes);
-
-            if ((attributes.map_state != IsViewable) || (attributes.width == attributes.height && attributes.width <= 5)) {
-                continue;
-            }
-            m_windows.push_back({static_cast<int>(attributes.x / m_ratio),
-                                 static_cast<int>(attributes.y / m_ratio),
-                                 static_cast<int>(attributes.width / m_ratio),
-                                 static_cast<int>(attributes.height / m_ratio)});
-        }
+    if (! display) return;
+    // 请求合成器不重定向全屏的截图窗口，直接显示到屏幕上
+    Atom atom = XInternAtom(display, "_NET_WM_BYPASS_COMPOSITOR", False);
+    long value = 1;
+    XChangeProperty(display, winId(), atom, XA_CARDINAL, 32, PropModeReplace, reinterpret_cast<unsigned char*>(&value), 1);
+    XFlush(display);
+}
+#endif // Q_OS_LINUX
 
-        XFree(children);
+DesktopImage MainWindow::fullScreenshot() {
+    CaptureEngine *engine = CaptureEngine::instance();
+    m_ratio = engine->ratio();
+#ifdef Q_OS_LINUX
+    QImage image = engine->takeStandby(standbyMaxAge);
+    if (! image.isNull()) {
+        qDebug() << "使用按下修饰键时预先截取的桌面";
+        return DesktopImage{image};
     }
-#endif
+#endif // Q_OS_LINUX
+    return engine->grabScreens();
+}
 
-    const QPoint &point = QCursor::pos();
-    for (int i = 0; i < m_windows.size(); ++i) {
-        if (m_windows[i].contains(point)) {
-            m_index = i;
+DesktopImage MainWindow::progressiveScreenshot() {
+#ifndef Q_OS_LINUX
+    // 其他屏幕要在后台线程截取，并且要抓取鼠标才能收到还没覆盖的屏幕上的点击
+    return fullScreenshot();
+#else
+    CaptureEngine *engine = CaptureEngine::instance();
+    const QVector<CaptureEngine::ScreenInfo> screens = engine->screens();
+    if (screens.size() < 2) return fullScreenshot();
+    m_ratio = engine->ratio();
+    DesktopImage image = engine->acquireScreens(QImage::Format_RGB32);
+    if (image.isNull()) return fullScreenshot();
+    // 屏幕之间的空隙不会被截取
+    for (auto iter = image.frames().cbegin(); iter != image.frames().cend(); ++iter) {
+        QImage view = image.view(iter->rect);
+        view.fill(Qt::black);
+    }
+    const QPoint cursor = QCursor::pos();
+    int first = 0;
+    for (int i = 0; i < screens.size(); ++i) {
+        if (screens[i].geometry.contains(cursor)) {
+            first = i;
             break;
         }
     }
+    QImage view = image.view(screens[first].native);
+    if (view.isNull() || ! engine->grabInto(view, screens[first].native)) return fullScreenshot();
+    for (int i = 0; i < screens.size(); ++i) {
+        if (i != first) m_pending_screens.push_back(screens[i].native);
+    }
+    m_captured = toLogicalRect(screens[first].native);
+    return image;
+#endif // Q_OS_LINUX
 }
 
-QImage MainWindow::fullScreenshot() {
-    QList<QScreen*> list = QApplication::screens();
-    QSize size;
-    m_ratio = -1;
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QRect rect = (*iter)->geometry();
-        qreal ratio = (*iter)->devicePixelRatio();
-        if (m_ratio == -1) {
-            m_ratio = ratio;
-        } else if (m_ratio != ratio) {
-            m_ratio = 0;
+QRect MainWindow::toLogicalRect(const QRect &native) const {
+    return QRect(qFloor(native.x() / m_ratio), qFloor(native.y() / m_ratio),
+                 qCeil(native.width() / m_ratio), qCeil(native.height() / m_ratio));
+}
+
+void MainWindow::captureScreen(const QRect &native) {
+    if (! m_pending_screens.contains(native)) return;
+    // 后台线程稍后送来的同一块屏幕会被丢弃
+    setScreen(native, CaptureEngine::instance()->grabRegion(native, QImage::Format_RGB32));
+}
+
+void MainWindow::setScreen(const QRect &native, const QImage &image) {
+    if (! m_pending_screens.removeOne(native)) return;
+    waitDim();
+    QElapsedTimer timer;
+    timer.start();
+    QImage view = m_desktop.view(native);
+    if (! view.isNull() && image.size() == view.size() && image.depth() == 32) {
+        const size_t bytes = static_cast<size_t>(view.width()) * 4;
+        for (int y = 0; y < view.height(); ++y) {
+            memcpy(view.scanLine(y), image.constScanLine(y), bytes);
         }
-        size.setWidth(qMax<int>((rect.right() + 1 - rect.left()) * ratio + rect.left(), size.width()));
-        size.setHeight(qMax<int>((rect.bottom() + 1 - rect.top()) * ratio + rect.top(), size.height()));
+        if (! m_paint_dim) {
+            // 只处理这块屏幕对应的区域
+            QImage gray = m_gray_image.view(native);
+            if (! gray.isNull()) {
+                dimImage(view, gray);
+            }
+        }
+    }
+    m_captured += toLogicalRect(native);
+    if (m_pending_screens.isEmpty()) {
+        clearMask();
+#ifdef Q_OS_LINUX
+        if (m_grab_mouse) {
+            this->releaseMouse();
+            m_grab_mouse = false;
+        }
+#endif // Q_OS_LINUX
+    } else {
+        setMask(m_captured);
     }
-    if (m_ratio <= 0) m_ratio = 1;
+    update(toLogicalRect(native));
+    qDebug() << QString("补全屏幕(%1, %2 %3x%4): %5ms")
+                    .arg(native.x()).arg(native.y()).arg(native.width()).arg(native.height())
+                    .arg(timer.nsecsElapsed() / 1e6, 0, 'f', 2);
+}
 
-    QImage image(size, QImage::Format_ARGB32);
-    QPainter painter(&image);
-    for (auto iter = list.cbegin(); iter != list.cend(); ++iter) {
-        QScreen *screen = (*iter);
-        qreal ratio = (*iter)->devicePixelRatio();
-        if (ratio == 1) {
-            painter.drawPixmap(screen->geometry(), screen->grabWindow(0));
-        } else {
-            QRect rect = screen->geometry();
-            QPixmap pixmap = screen->grabWindow(0);
-            painter.drawPixmap(rect.left(), rect.top(), rect.width() * ratio, rect.height() * ratio, pixmap);
+void MainWindow::captureRemaining() {
+#ifdef Q_OS_LINUX
+    if (! m_session || m_pending_screens.isEmpty()) return;
+    m_capture_scheduled = true;
+    // 在后台线程依次截取，期间界面仍然响应鼠标和键盘
+    const quint64 serial = m_screen_serial;
+    const QVector<QRect> pending = m_pending_screens;
+    if (m_screen_thread.joinable()) {
+        m_screen_thread.join();
+    }
+    m_screen_thread = std::thread{[this, serial, pending]() {
+        for (auto iter = pending.cbegin(); iter != pending.cend(); ++iter) {
+            const QRect native = *iter;
+            const QImage image = CaptureEngine::instance()->grabShm(native, QImage::Format_RGB32);
+            QMetaObject::invokeMethod(this, [this, serial, native, image]() {
+                if (serial != m_screen_serial) return;
+                // 共享内存截图失败时在界面线程重试
+                if (image.isNull()) {
+                    captureScreen(native);
+                } else {
+                    setScreen(native, image);
+                }
+            }, Qt::QueuedConnection);
+        }
+    }};
+#endif // Q_OS_LINUX
+}
+
+void MainWindow::captureSelection() {
+    if (m_pending_screens.isEmpty()) return;
+    QRect rect;
+    if (m_state & State::Free) {
+        rect = m_path.boundingRect().toAlignedRect();
+    } else if (m_state & State::Rect) {
+        rect = m_rect.normalized();
+    }
+    if (rect.isEmpty()) return;
+    // 只等待选区经过的屏幕
+    const QRect native(rect.topLeft() * m_ratio, rect.size() * m_ratio);
+    const QVector<QRect> pending = m_pending_screens;
+    for (auto iter = pending.cbegin(); iter != pending.cend(); ++iter) {
+        if (iter->intersects(native)) {
+            captureScreen(*iter);
         }
     }
-    painter.end();
-    return image;
 }
 
 #ifdef Q_OS_LINUX
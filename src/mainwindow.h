@@ -3,9 +3,13 @@
 
 #include <QSystemTrayIcon>
 #include <QMenu>
+#include <QElapsedTimer>
+#include <thread>
 
 #include "SettingWidget.h"
 #include "BaseWindow.h"
+#include "WindowIndex.h"
+#include "DesktopImage.h"
 #if defined(Q_OS_LINUX)
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
 #include <QX11Info>
@@ -19,6 +23,13 @@
 #endif
 
 class TopWidget;
+class AutoSaver;
+class RegionWatcher;
+class Timelapse;
+class CaptureHistory;
+#ifdef Q_OS_LINUX
+class CaptureExport;
+#endif // Q_OS_LINUX
 class MainWindow : public BaseWindow
 #ifdef Q_OS_LINUX
     , public QAbstractNativeEventFilter
@@ -100,6 +111,7 @@ private slots:
     void keyPress(int code, Qt::KeyboardModifiers modifiers);
     void mouseWheel(QSharedPointer<QWheelEvent> event);
     void grabMouseEvent();
+    void modifiersChanged(Qt::KeyboardModifiers modifiers);
 #endif // Q_OS_LINUX
 #ifdef OCR
     void ocrStart();
@@ -114,47 +126,139 @@ private slots:
     void updateAutoSave(const HotKey &key, quint8 mode, const QString &path);
     void updateCapture(const HotKey &key);
     void updateRecord(const HotKey &key);
+    void imageSaved(bool success, const QString &path, const QImage &thumbnail);
     void quit();
     void save(const QString &path="") override;
     void end() override;
+    void saveColor() override;
     TopWidget *top();
 private:
     void initTray();
     void openSaveDir();
+    void showMemory();
+    // 监视当前选区，变化时交给自动保存
+    void watchRegion();
+    // 定时截取当前选区
+    void timelapseRegion();
+    // native 为空时截取整个桌面
+    void startTimelapse(const QRect &native);
+    void stopTimelapse();
+    enum SaveResult {
+        Saved,       // 已经交给自动保存
+        QueueFull,   // 正在保存的截图过多，只跳过这一张
+        InvalidPath  // 自动保存路径无效，之后的也无法保存
+    };
+    // 交给自动保存
+    SaveResult saveFrame(const QImage &image, const QString &title, bool quiet);
+    // 把选区和形状合成到图片里，没有选区时返回空图片
+    QImage renderSelection();
+    // 当前选区的外接矩形（图片像素坐标）
+    QRect selectionRect() const;
+    // 确认截图（保存、复制、置顶）时发给共享内存的客户端，取消截图时不发送
+    void publishSelection();
+    // 加入批量截图后可以继续选择其他区域
+    void addBatch();
+    // 批量截图（包括当前选区）保存到自动保存目录，编号命名
+    void saveBatch();
+    void updateHistoryMenu();
+    // 从截图历史恢复，不重新截图
+    void recallPin(quint64 id);
+    void recallEdit(quint64 id);
     bool contains(const QPoint &point);
     void updateWindows();
-    QImage fullScreenshot();
+    void setWindows(quint64 serial, const QVector<QRect> &windows);
+    DesktopImage fullScreenshot();
+    DesktopImage progressiveScreenshot();
+    // 在界面线程截取一块还没截取的屏幕
+    void captureScreen(const QRect &native);
+    // image 为空时表示截图失败，这块屏幕保持黑色
+    void setScreen(const QRect &native, const QImage &image);
+    void captureRemaining();
+    void captureSelection();
+    QRect toLogicalRect(const QRect &native) const;
+    QRect magnifierRect(const QPoint &cursor) const;
+    QRegion overlayRegion() const;
+    void updateOverlay();
+    void startDim();
+    void waitDim();
 #ifdef Q_OS_LINUX
     QString getWindowTitle(Display *display, Window window);
+    void bypassCompositor();
     bool UnregisterHotKey(const HotKey &key);
     bool RegisterHotKey(HotKey &key);
     static int handleError(Display *display, XErrorEvent *error);
 #endif // Q_OS_LINUX
 #ifdef Q_OS_WINDOWS
-    QRect getRectByHwnd(HWND hwnd);
+    static QRect getRectByHwnd(HWND hwnd);
 #endif // Q_OS_WINDOWS
 
 #ifdef Q_OS_LINUX
     KeyMouseEvent *m_monitor;
+    CaptureExport *m_export;
     bool m_grab_mouse = false;
     HotKey m_key1;
     HotKey m_key2;
     HotKey m_key3;
     QString m_grab_error;
 #endif // Q_OS_LINUX
+    std::thread m_window_thread;
+    // 后台生成 m_gray_image，第一次绘制或者修改遮罩之前等待完成
+    std::thread m_dim_thread;
+    qint64 m_dim_nsecs = 0;
+    struct Stage {
+        const char *name;
+        qint64 nsecs;
+    };
+    // 本次截图从按下热键到第一次绘制各阶段的耗时
+    QVector<Stage> m_stages;
     QVector<QRect> m_windows;
+    WindowIndex m_window_index;
+    // 每次截图加一，丢弃上一次截图的窗口查询结果
+    quint64 m_window_serial = 0;
     int m_index;
     QSystemTrayIcon *m_tray = nullptr;
     QMenu *m_menu = nullptr;
     States m_state;
     ResizeImages m_resize;
-    QImage m_gray_image;
+    // 截图界面使用的桌面截图，不使用 BaseWindow::m_image
+    DesktopImage m_desktop;
+    DesktopImage m_gray_image;
+    // 为 true 时不生成 m_gray_image，绘制时叠加半透明遮罩
+    bool m_paint_dim;
+    // 从按下热键（或开始截图）到第一次绘制的耗时
+    QElapsedTimer m_first_paint;
+    // 正在截图，窗口在截图结束后仍然保持映射，不能用 isVisible 判断
+    bool m_session = false;
+    // 渐进截图时还没截取的屏幕（物理像素坐标）
+    QVector<QRect> m_pending_screens;
+    // 已经截取的屏幕，窗口只覆盖这些区域，其余屏幕保持原样以便截取
+    QRegion m_captured;
+    // 在后台截取其他屏幕，结果带上 m_screen_serial，截图结束后到达的结果丢弃
+    std::thread m_screen_thread;
+    quint64 m_screen_serial = 0;
+    bool m_capture_scheduled = false;
+    // 下次 start 使用的截图历史，本次截图来自历史时不再存入历史
+    DesktopImage m_recall;
+    bool m_recalled = false;
+    // 本次截图中已经加入批量截图的区域，都来自同一张 m_desktop
+    QVector<QImage> m_batch;
+    QVector<QRect> m_batch_rects;
+    // 上次绘制时选区和放大镜所在的区域
+    QRegion m_overlay;
     bool m_gif;
 
     QAction *m_action1 = nullptr;
     QAction *m_action2 = nullptr;
     QAction *m_action3 = nullptr;
+    QAction *m_memory_action = nullptr;
+    QAction *m_watch_action = nullptr;
+    QAction *m_timelapse_action = nullptr;
+    QMenu *m_history_menu = nullptr;
     SettingWidget *m_setting;
+    AutoSaver *m_saver;
+    RegionWatcher *m_watcher;
+    Timelapse *m_timelapse;
+    CaptureHistory *m_history;
 
     static MainWindow *self;
 };
@@ -533,38 +533,111 @@ void GifWritePalette( const GifPalette* pPal, FILE* f )
 // write the image header, LZW-compress and write out the image
 void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
 {
-    // graphics control extension
-    fputc(0x21, f);
-    fputc(0xf9, f);
-    fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
-    fputc(delay & 0xff, f);
-    fputc((delay >> 8) & 0xff, f);
-    fputc(kGifTransIndex, f); // transparent color index
-    fputc(0, f);
+    GifBlock block = {NULL, 0, 0};
+    GifEncodeLzwImage(&block, image, left, top, width, height, delay, pPal);
+    fwrite(block.data, 1, block.size, f);
+    GifBlockFree(&block);
+}
 
-    fputc(0x2c, f); // image descriptor block
+// make room for count more bytes
+static void GifBlockReserve( GifBlock* block, size_t count )
+{
+    if( block->size + count <= block->capacity ) return;
+
+    size_t capacity = block->capacity? block->capacity*2 : 4096;
+    while( capacity < block->size + count ) capacity *= 2;
+    uint8_t* data = (uint8_t*)GIF_MALLOC(capacity);
+    if( block->size ) memcpy(data, block->data, block->size);
+    GIF_FREE(block->data);
+    block->data = data;
+    block->capacity = capacity;
+}
 
-    fputc(left & 0xff, f);           // corner of image in canvas space
-    fputc((left >> 8) & 0xff, f);
-    fputc(top & 0xff, f);
-    fputc((top >> 8) & 0xff, f);
+// append one byte, growing the buffer as needed
+void GifBlockPut( GifBlock* block, int byte )
+{
+    GifBlockReserve(block, 1);
+    block->data[block->size++] = (uint8_t)byte;
+}
 
-    fputc(width & 0xff, f);          // width and height of image
-    fputc((width >> 8) & 0xff, f);
-    fputc(height & 0xff, f);
-    fputc((height >> 8) & 0xff, f);
+// free the buffer and reset the block to empty
+void GifBlockFree( GifBlock* block )
+{
+    GIF_FREE(block->data);
+    block->data = NULL;
+    block->size = 0;
+    block->capacity = 0;
+}
 
-    //fputc(0, f); // no local color table, no transparency
-    //fputc(0x80, f); // no local color table, but transparency
+// block versions of GifWriteChunk and GifWriteCode
+static void GifBlockWriteChunk( GifBlock* block, GifBitStatus* stat )
+{
+    GifBlockReserve(block, stat->chunkIndex + 1);
+    block->data[block->size++] = (uint8_t)stat->chunkIndex;
+    memcpy(block->data + block->size, stat->chunk, stat->chunkIndex);
+    block->size += stat->chunkIndex;
 
-    fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
-    GifWritePalette(pPal, f);
+    stat->bitIndex = 0;
+    stat->byte = 0;
+    stat->chunkIndex = 0;
+}
+
+static void GifBlockWriteCode( GifBlock* block, GifBitStatus* stat, uint32_t code, uint32_t length )
+{
+    for( uint32_t ii=0; ii<length; ++ii )
+    {
+        GifWriteBit(stat, code);
+        code = code >> 1;
+
+        if( stat->chunkIndex == 255 )
+        {
+            GifBlockWriteChunk(block, stat);
+        }
+    }
+}
+
+// same as GifWriteLzwImage, but into a block
+void GifEncodeLzwImage(GifBlock* block, const uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, const GifPalette* pPal)
+{
+    // graphics control extension
+    GifBlockPut(block, 0x21);
+    GifBlockPut(block, 0xf9);
+    GifBlockPut(block, 0x04);
+    GifBlockPut(block, 0x05); // leave prev frame in place, this frame has transparency
+    GifBlockPut(block, delay & 0xff);
+    GifBlockPut(block, (delay >> 8) & 0xff);
+    GifBlockPut(block, kGifTransIndex); // transparent color index
+    GifBlockPut(block, 0);
+
+    GifBlockPut(block, 0x2c); // image descriptor block
+
+    GifBlockPut(block, left & 0xff);           // corner of image in canvas space
+    GifBlockPut(block, (left >> 8) & 0xff);
+    GifBlockPut(block, top & 0xff);
+    GifBlockPut(block, (top >> 8) & 0xff);
+
+    GifBlockPut(block, width & 0xff);          // width and height of image
+    GifBlockPut(block, (width >> 8) & 0xff);
+    GifBlockPut(block, height & 0xff);
+    GifBlockPut(block, (height >> 8) & 0xff);
+
+    GifBlockPut(block, 0x80 + pPal->bitDepth-1); // local color table present, 2 ^ bitDepth entries
+
+    // palette, first color is transparency
+    GifBlockPut(block, 0);
+    GifBlockPut(block, 0);
+    GifBlockPut(block, 0);
+    for(int ii=1; ii<(1 << pPal->bitDepth); ++ii)
+    {
+        GifBlockPut(block, pPal->r[ii]);
+        GifBlockPut(block, pPal->g[ii]);
+        GifBlockPut(block, pPal->b[ii]);
+    }
 
     const int minCodeSize = pPal->bitDepth;
     const uint32_t clearCode = 1 << pPal->bitDepth;
 
-    fputc(minCodeSize, f); // min code size 8 bits
+    GifBlockPut(block, minCodeSize); // min code size 8 bits
 
     GifLzwNode* codetree = (GifLzwNode*)GIF_TEMP_MALLOC(sizeof(GifLzwNode)*4096);
 
@@ -578,7 +651,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     stat.bitIndex = 0;
     stat.chunkIndex = 0;
 
-    GifWriteCode(f, &stat, clearCode, codeSize);  // start with a fresh LZW dictionary
+    GifBlockWriteCode(block, &stat, clearCode, codeSize);  // start with a fresh LZW dictionary
 
     for(uint32_t yy=0; yy<height; ++yy)
     {
@@ -609,7 +682,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
             else
             {
                 // finish the current run, write a code
-                GifWriteCode(f, &stat, (uint32_t)curCode, codeSize);
+                GifBlockWriteCode(block, &stat, (uint32_t)curCode, codeSize);
 
                 // insert the new run into the dictionary
                 codetree[curCode].m_next[nextValue] = (uint16_t)++maxCode;
@@ -623,7 +696,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
                 if( maxCode == 4095 )
                 {
                     // the dictionary is full, clear it out and begin anew
-                    GifWriteCode(f, &stat, clearCode, codeSize); // clear tree
+                    GifBlockWriteCode(block, &stat, clearCode, codeSize); // clear tree
 
                     memset(codetree, 0, sizeof(GifLzwNode)*4096);
                     codeSize = (uint32_t)(minCodeSize + 1);
@@ -636,19 +709,27 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     }
 
     // compression footer
-    GifWriteCode(f, &stat, (uint32_t)curCode, codeSize);
-    GifWriteCode(f, &stat, clearCode, codeSize);
-    GifWriteCode(f, &stat, clearCode + 1, (uint32_t)minCodeSize + 1);
+    GifBlockWriteCode(block, &stat, (uint32_t)curCode, codeSize);
+    GifBlockWriteCode(block, &stat, clearCode, codeSize);
+    GifBlockWriteCode(block, &stat, clearCode + 1, (uint32_t)minCodeSize + 1);
 
     // write out the last partial chunk
     while( stat.bitIndex ) GifWriteBit(&stat, 0);
-    if( stat.chunkIndex ) GifWriteChunk(f, &stat);
+    if( stat.chunkIndex ) GifBlockWriteChunk(block, &stat);
 
-    fputc(0, f); // image block terminator
+    GifBlockPut(block, 0); // image block terminator
 
     GIF_TEMP_FREE(codetree);
 }
 
+// append an encoded frame to the file, blocks must be written in frame order
+bool GifWriteBlock( GifWriter* writer, const GifBlock* block )
+{
+    if(!writer->f) return false;
+
+    return fwrite(block->data, 1, block->size, writer->f) == block->size;
+}
+
 // Creates a gif file.
 // The input GIFWriter is assumed to be uninitialized.
 // The delay value is the time between frames in hundredths of a second - note that not all viewers pay much attention to this value.
@@ -720,7 +801,9 @@ bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uin
     const uint8_t* oldImage = writer->firstFrame? NULL : writer->oldImage;
     writer->firstFrame = false;
 
+    // unused palette entries are still written out, keep them deterministic
     GifPalette pal;
+    memset(&pal, 0, sizeof(pal));
     GifMakePalette((dither? NULL : oldImage), image, width, height, bitDepth, dither, &pal);
 
     if(dither)
@@ -151,6 +151,25 @@ void GifWritePalette( const GifPalette* pPal, FILE* f );
 // write the image header, LZW-compress and write out the image
 void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal);
 
+// Growable in-memory output. Lets a frame be compressed on any thread and appended to
+// the file later - the bytes are exactly what GifWriteLzwImage would have written.
+typedef struct
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} GifBlock;
+
+// append one byte, growing the buffer as needed
+void GifBlockPut( GifBlock* block, int byte );
+
+// free the buffer and reset the block to empty
+void GifBlockFree( GifBlock* block );
+
+// same as GifWriteLzwImage, but into a block. Only reads the image and the palette,
+// so several frames can be encoded at once once their palettes are known.
+void GifEncodeLzwImage(GifBlock* block, const uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, const GifPalette* pPal);
+
 typedef struct
 {
     FILE* f;
@@ -176,4 +195,7 @@ bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uin
 // but it's still a good idea to write it out.
 bool GifEnd( GifWriter* writer );
 
+// append an encoded frame to the file, blocks must be written in frame order
+bool GifWriteBlock( GifWriter* writer, const GifBlock* block );
+
 #endif